@@ -0,0 +1,109 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <random>
+
+// relative difference of a from the exact value b
+double relerr(double a, double b)
+{
+    if (std::isnan(a) && std::isnan(b))
+        return 0.;
+    if (a == b)
+        return std::signbit(a) == std::signbit(b) ? 0. : 1.;
+    return std::fabs(a - b) / std::fabs(b);
+}
+
+struct Case {
+    const char *expr;
+    double xmin, xmax;   // x is uniform in [xmin, xmax], or exp() of that if logx
+    bool logx;
+    double ymin, ymax;
+};
+
+int main()
+{
+    std::vector <Case> cases = {
+        {"exp(x)",      -708., 708.,   false, 0., 0.},
+        {"exp(x)",      -750., 750.,   false, 0., 0.},  // overflow and underflow
+        {"log(x)",      -700., 700.,   true,  0., 0.},
+        {"log(x)",      0.5,   2.,     false, 0., 0.},
+        {"sin(x)",      -10.,  10.,    false, 0., 0.},
+        {"sin(x)",      -1e5,  1e5,    false, 0., 0.},
+        {"cos(x)",      -10.,  10.,    false, 0., 0.},
+        {"cos(x)",      -1e5,  1e5,    false, 0., 0.},
+        {"x^y",         -5.,   5.,     true,  -100., 100.},
+        {"pow(x, y)",   -10.,  1000.,  false, -3., 3.},
+    };
+    const int npts = 100000;
+
+    int failed = 0;
+    std::mt19937_64 rng(12345);
+    for (const Case &c : cases) {
+        std::uniform_real_distribution <double> ux(c.xmin, c.xmax), uy(c.ymin, c.ymax);
+        std::vector <double> x(npts), y(npts), ref(npts), res(npts);
+        for (int i=0; i<npts; i++) {
+            x[i] = c.logx ? std::exp(ux(rng)) : ux(rng);
+            y[i] = uy(rng);
+        }
+        x[0] = 0.; x[1] = -0.; x[2] = INFINITY; x[3] = NAN; x[4] = 1.;  // special values
+
+        VFormula <double> vf;
+        vf.AddVariable("x");
+        vf.AddVariable("y");
+        if (vf.ParseExpr(c.expr) != 1024 || !vf.Validate()) {
+            std::cout << c.expr << ": " << vf.GetErrorString() << std::endl;
+            return -2;
+        }
+        const double *cols[] = {x.data(), y.data()};
+        vf.EvalBatch(cols, npts, ref.data());
+        vf.Compile(); // recompiled when the accuracy changes
+
+        for (auto acc : {VFormula <double>::Approx12, VFormula <double>::Approx6}) {
+            vf.SetAccuracy(acc);
+            double bound = acc == VFormula <double>::Approx12 ? 1e-12 : 1e-6;
+            double maxerr = 0.;
+            // one point at a time with both backends and the native code, then with the batch evaluator
+            VFormula <double>::Context ctx = vf.MakeContext();
+            for (auto mode : {VFormula <double>::StackMachine, VFormula <double>::RegisterMachine}) {
+                vf.SetBackend(mode);
+                for (int i=0; i<npts; i++) {
+                    ctx.Var[0] = x[i];
+                    ctx.Var[1] = y[i];
+                    maxerr = std::max(maxerr, relerr(vf.Eval(ctx), ref[i]));
+                }
+            }
+            for (int i=0; i<npts; i++) {
+                ctx.Var[0] = x[i];
+                ctx.Var[1] = y[i];
+                maxerr = std::max(maxerr, relerr(vf.EvalNative(ctx), ref[i]));
+            }
+            vf.EvalBatch(cols, npts, res.data());
+            for (int i=0; i<npts; i++)
+                maxerr = std::max(maxerr, relerr(res[i], ref[i]));
+
+            bool ok = maxerr < bound;
+            std::cout << c.expr << " \t[" << c.xmin << ", " << c.xmax << (c.logx ? "] (log) " : "] ")
+                      << "max relative error " << maxerr << " \t(bound " << bound << ") "
+                      << (ok ? "OK" : "FAILED") << std::endl;
+            if (!ok)
+                failed++;
+        }
+    }
+
+// the numbers are folded exactly, whatever the accuracy at parsing
+    VFormula <double> folded;
+    folded.AddVariable("x");
+    folded.SetAccuracy(VFormula <double>::Approx6);
+    if (folded.ParseExpr("x+exp(1)") != 1024 || !folded.Validate())
+        return -2;
+    folded.SetAccuracy(VFormula <double>::Exact);
+    bool exact = folded.Eval(0.) == std::exp(1.);
+    std::cout << "exp(1) folded under Approx6, then Exact: " << folded.Eval(0.) << (exact ? " OK" : " FAILED") << std::endl;
+    if (!exact)
+        failed++;
+
+    std::cout << (failed ? "Accuracy test FAILED" : "Accuracy test passed") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+#include "vformula.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+
+void Setup(VFormula <double> &vf)
+{
+    vf.AddConstant("pi", M_PI);
+    vf.AddConstant("s", 0.3);
+    vf.AddVariable("x");
+    vf.AddVariable("y");
+}
+
+// overwrites one byte of the file
+void Patch(const std::string &path, long pos, char c)
+{
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(pos);
+    f.put(c);
+}
+
+int main()
+{
+    std::vector <std::string> exprs;
+    for (int i=0; i<1000; i++) {
+        std::string k = std::to_string(i);
+        exprs.push_back("exp(-(x-" + k + ".5)^2/(2*s^2))*sin(2*pi*y/" + k + ".1+1)");
+        exprs.push_back("t=x*" + k + "+y; t*t+max(t, s)");
+    }
+    exprs.push_back("sin(x");  // fails to parse: saved as an empty program
+
+    VThreadPool pool;
+    VFormula <double> proto;
+    Setup(proto);
+    std::vector <int> errpos;
+    std::vector <VProgram> programs = proto.CompileAll(pool, exprs, errpos);
+
+    const std::string path = "test_bundle.vfpb";
+    VProgramBundle bundle;
+    if (!bundle.Save(path, proto, programs)) {
+        std::cout << bundle.GetErrorString() << std::endl;
+        return -1;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    bool ok = bundle.Open(path);
+    auto end = std::chrono::high_resolution_clock::now();
+    if (!ok) {
+        std::cout << bundle.GetErrorString() << std::endl;
+        return -1;
+    }
+    std::cout << "Opened " << bundle.size() << " programs in "
+              << std::chrono::duration <double, std::micro> (end - start).count() << " us" << std::endl;
+
+// a formula set up from the file evaluates the programs as the formulas parsed from the text
+    VFormula <double> vf;
+    ok = bundle.Setup(vf) && bundle.size() == exprs.size();
+    int mismatches = 0;
+    VProgram prg;
+    for (size_t i=0; ok && i<bundle.size(); i++) {
+        if (!bundle.GetProgram(i, prg)) {
+            mismatches++;
+            continue;
+        }
+        VFormula <double> ref;
+        Setup(ref);
+        if (ref.ParseExpr(exprs[i]) != 1024) {
+            if (!prg.Command.empty())
+                mismatches++;
+            continue;
+        }
+        vf.LoadProgram(prg);
+        for (double x : {-1., 0.25, 3.}) {
+            vf.SetVariable("y", x/2);
+            ref.SetVariable("y", x/2);
+            if (vf.Eval(x) != ref.Eval(x))
+                mismatches++;
+        }
+        vf.SetBackend(VFormula <double>::RegisterMachine);
+        if (vf.Eval(1.5) != ref.Eval(1.5))
+            mismatches++;
+        vf.SetBackend(VFormula <double>::StackMachine);
+    }
+    std::cout << "Mismatches: " << mismatches << std::endl;
+    ok = ok && mismatches == 0;
+
+// a formula with other symbols is told apart
+    VFormula <double> other;
+    other.AddVariable("z");
+    ok = ok && !bundle.Setup(other);
+
+// damaged files are rejected
+    bundle.Close();
+    Patch(path, 200, '\x55');
+    bool corrupt = !bundle.Open(path);
+    std::cout << "Corrupted file: " << bundle.GetErrorString() << std::endl;
+    bool trusted = bundle.Open(path, false); // the checksum is not checked
+    Patch(path, 4, '\x07');
+    bool version = !bundle.Open(path);
+    std::cout << "Future version: " << bundle.GetErrorString() << std::endl;
+    ok = ok && corrupt && trusted && version;
+    std::remove(path.c_str());
+
+    std::cout << (ok ? "Bundle test passed" : "Bundle test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <thread>
+#include <chrono>
+
+// the same symbols in every formula, so that they share the cached programs
+void Setup(VFormula <double> &vf)
+{
+    vf.AddConstant("pi", M_PI);
+    vf.AddVariable("x");
+}
+
+int main()
+{
+    std::vector <std::string> exprs = {
+        "2*sin(x/10*pi)",
+        "x^2+3*x+1",
+        "exp(-x^2/2)/sqrt(2*pi)",
+        "t=x*x; t*t-t",
+        "(x+1)*(x+1)+sin(x+1)",
+        "max(x, 0)+min(x, 1)",
+        "1/(1+exp(-x))",
+        "log(abs(x)+1)*cos(x)",
+        "pow(abs(x), 1.5)-x^3",
+        "tanh(x)*2+atan(x)",
+        "sqrt(x*x+1)",
+        "-(x-1)*(x+2)*(x-3)",
+    };
+    std::vector <double> points = {-3.3, -1., 0., 0.5, 2., 7.};
+
+// reference values, parsed without the cache
+    std::vector <std::vector<double>> ref(exprs.size());
+    for (size_t i=0; i<exprs.size(); i++) {
+        VFormula <double> vf;
+        Setup(vf);
+        if (vf.ParseExpr(exprs[i]) != 1024 || !vf.Validate()) {
+            std::cout << exprs[i] << ": " << vf.GetErrorString() << std::endl;
+            return -2;
+        }
+        for (double x : points)
+            ref[i].push_back(vf.Eval(x));
+    }
+
+// threads parsing the expressions over and over through one cache, smaller than the set
+    VProgramCache cache(8);
+    int nthreads = 4;
+    int nrounds = 200;
+    std::vector <int> mismatches(nthreads, 0);
+    std::vector <std::thread> workers;
+    for (int t=0; t<nthreads; t++)
+        workers.emplace_back([&, t]() {
+            VFormula <double> vf;
+            Setup(vf);
+            for (int r=0; r<nrounds; r++) {
+                // the first half of the set is used more often and stays in the cache
+                size_t i = r % 3 == 0 ? (r/3 + t) % exprs.size() : (r + t) % (exprs.size()/2);
+                if (vf.ParseExpr(cache, exprs[i]) != 1024) {
+                    mismatches[t]++;
+                    continue;
+                }
+                for (size_t k=0; k<points.size(); k++) {
+                    double y = vf.Eval(points[k]);
+                    if (!(y == ref[i][k]) && !(std::isnan(y) && std::isnan(ref[i][k])))
+                        mismatches[t]++;
+                }
+            }
+        });
+    for (std::thread &w : workers)
+        w.join();
+
+    int total = 0;
+    for (int m : mismatches)
+        total += m;
+    VProgramCache::Stats stats = cache.GetStats();
+    std::cout << "Parses: " << nthreads*nrounds << ", hits: " << stats.hits << ", misses: " << stats.misses
+              << ", evictions: " << stats.evictions << ", cached programs: " << stats.size << std::endl;
+    std::cout << "Mismatches: " << total << std::endl;
+    bool ok = total == 0 && stats.hits + stats.misses == size_t(nthreads*nrounds) && stats.size <= 8;
+
+// a formula with other symbols does not get the programs of the others
+    {
+        VFormula <double> vf;
+        Setup(vf);
+        vf.AddVariable("y");
+        size_t misses = cache.GetStats().misses;
+        vf.ParseExpr(cache, exprs[0]);
+        ok = ok && cache.GetStats().misses == misses + 1;
+    }
+
+// one formula parsing the same expressions over and over: the variables its expressions created
+// (assignment targets, CSE temporaries) do not change the key, so each program is cached once
+    {
+        VProgramCache own(8);
+        VFormula <double> vf;
+        Setup(vf);
+        const size_t repeated[] = {3, 4, 0};
+        int wrong = 0;
+        for (int r=0; r<4; r++)
+            for (size_t i : repeated) {
+                if (vf.ParseExpr(own, exprs[i]) != 1024 || !(vf.Eval(points[1]) == ref[i][1]))
+                    wrong++;
+            }
+        VProgramCache::Stats own_stats = own.GetStats();
+        std::cout << "One formula, 3 expressions 4 times: hits " << own_stats.hits << ", misses " << own_stats.misses
+                  << ", cached programs " << own_stats.size << std::endl;
+        ok = ok && wrong == 0 && own_stats.hits == 9 && own_stats.misses == 3 && own_stats.size == 3;
+    }
+
+// parsing time with and without the cache
+    {
+        VFormula <double> vf;
+        Setup(vf);
+        int nparses = 100000;
+        std::string f = "exp(-(x-1.5)^2/(2*0.3^2))*sin(2*pi*x/4.5)+log(1+x*x)/(1+abs(x))";
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i=0; i<nparses; i++) {
+            vf.ParseExpr(f);
+            vf.Validate();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "ParseExpr() and Validate(): "
+                  << std::chrono::duration <double, std::micro> (end - start).count()/nparses << " us" << std::endl;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (int i=0; i<nparses; i++)
+            vf.ParseExpr(cache, f);
+        end = std::chrono::high_resolution_clock::now();
+        std::cout << "ParseExpr() from the cache: "
+                  << std::chrono::duration <double, std::micro> (end - start).count()/nparses << " us" << std::endl;
+    }
+
+    std::cout << (ok ? "Cache test passed" : "Cache test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
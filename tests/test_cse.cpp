@@ -0,0 +1,77 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+
+// Each formula is checked against a reference written with the shared subexpressions in another
+// operand order (y*x for x*y): the parser does not match those, so the reference has no temporaries
+// and computes every subexpression where it appears, giving the same bits.
+struct Case {
+    std::string expr, refexpr;
+    int ntemps; // _cseN temporaries expected in the program of expr
+};
+
+int CountTemps(VFormula <double> &vf)
+{
+    int n = 0;
+    for (const std::string &name : vf.GetVarMap())
+        if (name.compare(0, 4, "_cse") == 0)
+            n++;
+    return n;
+}
+
+int main()
+{
+    const std::vector <Case> cases = {
+        {"exp(x*y)+cos(x*y)", "exp(x*y)+cos(y*x)", 1},
+        {"sin(x*y+z)/(1+(x*y+z)^2)", "sin(x*y+z)/(1+(y*x+z)^2)", 1},
+    // x is reassigned between the two x*y: they are different values
+        {"u=x*y; x=x+1; u+x*y", "u=x*y; x=x+1; u+y*x", 0},
+        {"u=sin(x*y); x=u*2; v=sin(x*y)+sin(x*y); v*u", "u=sin(x*y); x=u*2; v=sin(x*y)+sin(y*x); v*u", 1},
+    // shared by two assignments, the second of which changes one of its arguments
+        {"w=x*z; x=x*z; x+w+x*z", "w=x*z; x=z*x; x+w+x*z", 1},
+        {"w=x*z+y; z=w; z*(x*z+y)", "w=x*z+y; z=w; z*(z*x+y)", 0},
+    };
+
+    bool ok = true;
+    for (const Case &c : cases) {
+        VFormula <double> vf, vr;
+        for (VFormula <double> *f : {&vf, &vr}) {
+            f->AddVariable("x");
+            f->AddVariable("y");
+            f->AddVariable("z");
+        }
+        if (vf.ParseExpr(c.expr) != 1024 || !vf.Validate() || vr.ParseExpr(c.refexpr) != 1024 || !vr.Validate()) {
+            std::cout << "Can not parse " << c.expr << " or " << c.refexpr << std::endl;
+            return -1;
+        }
+        int ntemps = CountTemps(vf), reftemps = CountTemps(vr);
+
+        int mismatches = 0;
+        VFormula <double>::Context ctx = vf.MakeContext(), rctx = vr.MakeContext();
+        for (int i=0; i<100; i++) {
+            double x = -2. + 0.041*i, y = 0.3 + 0.017*i, z = std::cos(0.1*i);
+            vr.SetVariable(rctx, "x", x);
+            vr.SetVariable(rctx, "y", y);
+            vr.SetVariable(rctx, "z", z);
+            double ref = vr.Eval(rctx);
+            for (auto mode : {VFormula <double>::StackMachine, VFormula <double>::RegisterMachine}) {
+                vf.SetBackend(mode);
+                vf.SetVariable(ctx, "x", x); // the formula itself may have changed it
+                vf.SetVariable(ctx, "y", y);
+                vf.SetVariable(ctx, "z", z);
+                double val = vf.Eval(ctx);
+                if (val != ref && !(std::isnan(val) && std::isnan(ref)))
+                    mismatches++;
+            }
+        }
+        bool passed = mismatches == 0 && ntemps == c.ntemps && reftemps == 0;
+        std::cout << c.expr << ": " << ntemps << " temporaries (expected " << c.ntemps << "), "
+                  << mismatches << " mismatches " << (passed ? "OK" : "FAILED") << std::endl;
+        ok = ok && passed;
+    }
+
+    std::cout << (ok ? "CSE test passed" : "CSE test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
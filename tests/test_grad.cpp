@@ -0,0 +1,98 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+// derivatives of the formula with respect to the parameters by central differences
+std::vector <double> NumGrad(VFormula <double> &vf, double x)
+{
+    std::vector <double> grad(vf.GetConstCount());
+    for (int i=0; i<vf.GetConstCount(); i++) {
+        double p = vf.GetConstant(i);
+        double h = 1e-6 * std::max(1., std::fabs(p));
+        vf.SetConstant(i, p + h);
+        double up = vf.Eval(x);
+        vf.SetConstant(i, p - h);
+        double down = vf.Eval(x);
+        vf.SetConstant(i, p);
+        grad[i] = (up - down) / (2*h);
+    }
+    return grad;
+}
+
+int main()
+{
+// every operation and function with parameters in its arguments
+    std::vector <std::string> exprs = {
+        "a*exp(-(x-b)^2/(2*c^2))+d+e*x",
+        "a/(1+exp(-(x-b)/c))-d^3+sqrt(e)",
+        "sin(a*x+b)*cos(c*x)+tan(d)-e",
+        "asin(a/3)+acos(b/3)*atan(c*x)+x^d+pow(e, x)",
+        "sinh(a)*cosh(b/x)+tanh(c*x)+asinh(d)+acosh(e+1)+atanh(a/2)",
+        "log(a*x)+abs(b-x)+max(c, x)*min(d, e*x)",
+        "t=a*x+b; u=t*t; -u/(1+u)+c*t*t-d/t+e",
+    };
+    const double pars[] = {1.3, 0.4, 0.8, 1.7, 0.6};
+    const char *names[] = {"a", "b", "c", "d", "e"};
+    const int npar = 5;
+
+    double maxerr = 0.;
+    for (const std::string &expr : exprs) {
+        VFormula <double> vf;
+        for (int i=0; i<npar; i++)
+            vf.AddConstant(names[i], pars[i]);
+        vf.AddVariable("x");
+        if (vf.ParseExpr(expr) != 1024 || !vf.Validate()) {
+            std::cout << expr << ": " << vf.GetErrorString() << std::endl;
+            return -1;
+        }
+        std::vector <double> grad(vf.GetConstCount()), xgrad(vf.GetVarMap().size());
+        for (double x : {0.3, 1.1, 2.5}) {
+            double val = vf.EvalGrad(x, grad.data(), xgrad.data());
+            if (val != vf.Eval(x)) {
+                std::cout << expr << ": value " << val << " instead of " << vf.Eval(x) << std::endl;
+                maxerr = INFINITY;
+            }
+            std::vector <double> num = NumGrad(vf, x);
+            double h = 1e-6 * x;
+            num.push_back((vf.Eval(x + h) - vf.Eval(x - h)) / (2*h));
+            grad.push_back(xgrad[0]);
+            for (size_t i=0; i<num.size(); i++) {
+                double err = std::fabs(grad[i] - num[i]) / std::max(1., std::fabs(num[i]));
+                if (!(err < 1e-6))
+                    std::cout << expr << " at x=" << x << ": derivative " << i << " is " << grad[i]
+                              << ", numerically " << num[i] << std::endl;
+                maxerr = std::max(maxerr, err);
+            }
+            grad.pop_back();
+        }
+    }
+    std::cout << "Maximum difference from the numerical derivatives: " << maxerr << std::endl;
+
+// one EvalGrad() against the 2N+1 evaluations of the central differences
+    VFormula <double> vf;
+    for (int i=0; i<npar; i++)
+        vf.AddConstant(names[i], pars[i]);
+    vf.AddVariable("x");
+    vf.ParseExpr(exprs[0]);
+    std::vector <double> grad(npar);
+    const int neval = 200000;
+    double sum = 0.;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i=0; i<neval; i++)
+        sum += vf.EvalGrad(i*1e-5, grad.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "EvalGrad(): " << std::chrono::duration <double, std::nano> (end - start).count()/neval << " ns, ";
+    start = std::chrono::high_resolution_clock::now();
+    for (int i=0; i<neval; i++)
+        sum += NumGrad(vf, i*1e-5)[0] + vf.Eval(i*1e-5);
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "central differences: " << std::chrono::duration <double, std::nano> (end - start).count()/neval << " ns"
+              << (sum == 0. ? " " : "") << std::endl;
+
+    bool ok = maxerr < 1e-6;
+    std::cout << (ok ? "Gradient test passed" : "Gradient test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+// Model formulas with parameters s, m (constants) in the parameter-only subexpressions. The reference
+// formula reads the parameters as variables vs, vm instead, so nothing is hoisted out of its program.
+struct Model {
+    const char *name;
+    std::string expr, refexpr;
+};
+
+int main()
+{
+    const std::vector <Model> models = {
+        {"Gaussian", "1/(sqrt(2*pi)*s)*exp(-(x-m)^2/(2*s^2))", "1/(sqrt(2*pi)*vs)*exp(-(x-vm)^2/(2*vs^2))"},
+        {"Breit-Wigner", "s/(2*pi)/((x-m)^2+s^2/4)", "vs/(2*pi)/((x-vm)^2+vs^2/4)"},
+        {"exponential", "exp(-x/s)/(s*(1-exp(-m/s)))", "exp(-x/vs)/(vs*(1-exp(-vm/vs)))"},
+    };
+    const size_t n = 1000000;
+    std::vector <double> x(n), out(n), ref(n);
+    for (size_t i=0; i<n; i++)
+        x[i] = -3. + 6.*i/n;
+    bool ok = true;
+
+    for (const Model &model : models) {
+        VFormula <double> vf, vr;
+        vf.AddConstant("pi", M_PI);
+        vf.AddConstant("s", 0.7);
+        vf.AddConstant("m", 0.2);
+        vf.AddVariable("x");
+        vr.AddConstant("pi", M_PI);
+        vr.AddVariable("x");
+        vr.AddVariable("vs");
+        vr.AddVariable("vm");
+        if (vf.ParseExpr(model.expr) != 1024 || !vf.Validate() || vr.ParseExpr(model.refexpr) != 1024 || !vr.Validate()) {
+            std::cout << "Can not parse " << model.expr << " or " << model.refexpr << std::endl;
+            return -1;
+        }
+        std::cout << model.name << ": " << model.expr << ", " << vf.GetPrg().size() << " commands instead of "
+                  << vr.GetPrg().size() << std::endl;
+        ok = ok && !vf.HoistCode.empty();
+
+        VFormula <double>::Context ctx = vf.MakeContext(), rctx = vr.MakeContext();
+        vf.Bind(ctx, vf.GetSlot("x"), x);
+        vr.Bind(rctx, vr.GetSlot("x"), x);
+        bool compiled = vf.Compile() && vr.Compile();
+        int mismatches = 0;
+
+    // the hoisted constants follow the changes of the parameters in every backend
+        for (double s : {0.7, 1.3, 0.25}) {
+            vf.SetConstant("s", s);
+            vr.SetVariable(rctx, "vs", s);
+            vr.SetVariable(rctx, "vm", 0.2);
+            vf.EvalInto(ctx, out.data());
+            vr.EvalInto(rctx, ref.data());
+            for (size_t i=0; i<n; i += 997) {
+                if (out[i] != ref[i])
+                    mismatches++;
+                double y = vr.Eval(rctx, x[i], s);
+                for (auto mode : {VFormula <double>::StackMachine, VFormula <double>::RegisterMachine}) {
+                    vf.SetBackend(mode);
+                    if (vf.Eval(ctx, x[i]) != y)
+                        mismatches++;
+                }
+                if (compiled && vf.EvalNative(ctx, x[i]) != y)
+                    mismatches++;
+            // the derivatives with respect to the parameters go through the hoisted constants
+                std::vector <double> pargrad(vf.GetConstCount()), refpar(vr.GetConstCount()), vargrad(3);
+                vf.EvalGrad(ctx, x[i], pargrad.data());
+                vr.EvalGrad(rctx, x[i], refpar.data(), vargrad.data());
+                for (int k : {1, 2})
+                    if (std::abs(pargrad[k] - vargrad[k]) > 1e-12*std::abs(vargrad[k]))
+                        mismatches++;
+            }
+        }
+    // a program taken from GetProgram() recomputes them as well
+        VProgram prg;
+        vf.GetProgram(prg);
+        VFormula <double> loaded;
+        loaded.AddConstant("pi", M_PI);
+        loaded.AddConstant("s", 1.);
+        loaded.AddConstant("m", 0.2);
+        loaded.AddVariable("x");
+        loaded.LoadProgram(prg);
+        loaded.SetConstant("s", 0.9);
+        if (loaded.Eval(0.5) != vr.Eval(rctx, 0.5, 0.9))
+            mismatches++;
+        std::cout << "  mismatches: " << mismatches << std::endl;
+        ok = ok && mismatches == 0;
+
+    // timing over the points, with the parameters hoisted and read as variables
+        vf.SetBackend(VFormula <double>::StackMachine);
+        auto start = std::chrono::high_resolution_clock::now();
+        vr.EvalInto(rctx, ref.data());
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "  parameters as variables: " << std::chrono::duration <double, std::nano> (end - start).count() / n << " ns/point" << std::endl;
+        start = std::chrono::high_resolution_clock::now();
+        vf.EvalInto(ctx, out.data());
+        end = std::chrono::high_resolution_clock::now();
+        std::cout << "  hoisted:                 " << std::chrono::duration <double, std::nano> (end - start).count() / n << " ns/point" << std::endl;
+    }
+
+    std::cout << (ok ? "Hoisting test passed" : "Hoisting test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
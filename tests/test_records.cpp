@@ -0,0 +1,83 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <chrono>
+
+// an event record with many fields, of which the formula reads three
+struct Event {
+    int run, id;
+    double e, px, py, pz;
+    double other[24];
+};
+
+int main()
+{
+    const size_t nevents = 2000000;
+    std::vector <Event> events(nevents);
+    for (size_t i=0; i<nevents; i++) {
+        Event &ev = events[i];
+        ev.run = 1;
+        ev.id = i;
+        ev.px = std::sin(0.001*i);
+        ev.py = std::cos(0.003*i);
+        ev.pz = 0.5 + 1e-6*i;
+        ev.e = 2.;
+        for (double &x : ev.other)
+            x = 1.;
+    }
+
+    const std::string f = "sqrt(px*px + py*py)/(pz + m)";
+    VFormula <double> vf;
+    vf.AddConstant("m", 0.14);
+    vf.AddVariable("px");
+    vf.AddVariable("py");
+    vf.AddVariable("pz");
+    vf.AddVariable("unused");
+    if (vf.ParseExpr(f) != 1024 || !vf.Validate()) {
+        std::cout << "Can not parse " << f << ": " << vf.GetErrorString() << std::endl;
+        return -1;
+    }
+    std::cout << "Expression to evaluate: " << f << " over " << nevents << " records" << std::endl;
+    const size_t px = vf.GetSlot("px"), py = vf.GetSlot("py"), pz = vf.GetSlot("pz");
+
+// the fields are first copied into columns
+    std::vector <double> ref(nevents), out(nevents);
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector <std::vector <double>> columns(3, std::vector <double> (nevents));
+    for (size_t i=0; i<nevents; i++) {
+        columns[0][i] = events[i].px;
+        columns[1][i] = events[i].py;
+        columns[2][i] = events[i].pz;
+    }
+    std::vector <const double*> cols(vf.GetVarMap().size(), nullptr);
+    for (int v=0; v<3; v++)
+        cols[v] = columns[v].data();
+    vf.EvalBatch(cols.data(), nevents, ref.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Columns, EvalBatch():     " << std::chrono::duration <double, std::milli> (end - start).count() << " ms" << std::endl;
+
+// the fields are gathered from the records batch by batch
+    VFormula <double>::Context ctx = vf.MakeContext();
+    bool ok = vf.Bind(ctx, px, events.data(), &Event::px, nevents)
+           && vf.Bind(ctx, py, events.data(), sizeof(Event), offsetof(Event, py), nevents)
+           && vf.Bind(ctx, pz, events.data(), &Event::pz, nevents);
+    start = std::chrono::high_resolution_clock::now();
+    vf.EvalInto(ctx, out.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "Bound records, EvalInto(): " << std::chrono::duration <double, std::milli> (end - start).count() << " ms" << std::endl;
+
+    size_t mismatches = 0;
+    for (size_t i=0; i<nevents; i++) {
+        vf.SetVariable(ctx, pz, events[i].pz);
+        if (out[i] != ref[i] || out[i] != vf.Eval(ctx, events[i].px, events[i].py))
+            mismatches++;
+    }
+    std::cout << "Mismatches: " << mismatches << std::endl;
+    ok = ok && mismatches == 0;
+
+    std::cout << (ok ? "Record binding test passed" : "Record binding test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
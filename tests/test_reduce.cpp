@@ -0,0 +1,102 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+typedef VFormula <double> VF;
+
+// sum in long double as the reference
+long double Sum(const std::vector <double> &terms)
+{
+    long double sum = 0;
+    for (double t : terms)
+        sum += t;
+    return sum;
+}
+
+int main()
+{
+    const size_t n = 1000003;
+    const std::string f = "a*exp(-(x-m)^2/(2*s^2)) + b";
+    VF vf;
+    vf.AddConstant("a", 10.);
+    vf.AddConstant("m", 0.3);
+    vf.AddConstant("s", 1.2);
+    vf.AddConstant("b", 0.5);
+    vf.AddVariable("x");
+    if (vf.ParseExpr(f) != 1024 || !vf.Validate()) {
+        std::cout << "Can not parse " << f << ": " << vf.GetErrorString() << std::endl;
+        return -1;
+    }
+    std::cout << "Expression to evaluate: " << f << " over " << n << " points" << std::endl;
+
+    std::vector <double> x(n), y(n), sigma(n), w(n), val(n);
+    for (size_t i=0; i<n; i++) {
+        x[i] = -5. + 10.*i/n;
+        y[i] = 10.*std::exp(-x[i]*x[i]/2) + 0.5 + 0.1*std::sin(7.*i);
+        sigma[i] = std::sqrt(y[i]);
+        w[i] = 1. + (i % 3);
+    }
+
+    VF::Context ctx = vf.MakeContext();
+    bool ok = vf.Bind(ctx, vf.GetSlot("x"), x);
+    vf.EvalInto(ctx, val.data());
+
+// the reductions agree with the sums of the stored values
+    std::vector <double> sum(n), chi2(n), nll(n);
+    for (size_t i=0; i<n; i++) {
+        sum[i] = w[i]*val[i];
+        double d = (val[i] - y[i])/sigma[i];
+        chi2[i] = d*d;
+        nll[i] = -std::log(val[i]);
+    }
+    struct {const char *name; double value; long double ref;} checks[] = {
+        {"sum(w*f)", vf.Reduce(ctx, VF::ReduceSum, w.data()), Sum(sum)},
+        {"chi2", vf.Reduce(ctx, VF::ReduceChi2, nullptr, y.data(), sigma.data()), Sum(chi2)},
+        {"-log L", vf.Reduce(ctx, VF::ReduceNegLogL), Sum(nll)}
+    };
+    for (auto &c : checks) {
+        double err = std::abs((c.value - c.ref)/c.ref);
+        std::cout << c.name << " = " << c.value << ", relative error " << err << std::endl;
+        ok = ok && err < 1e-14;
+    }
+
+// the same result for any number of threads
+    double ref = vf.Reduce(ctx, VF::ReduceChi2, w.data(), y.data(), sigma.data());
+    for (unsigned nthreads : {1, 2, 3, 8}) {
+        VThreadPool pool(nthreads);
+        double chi = vf.Reduce(pool, ctx, VF::ReduceChi2, w.data(), y.data(), sigma.data());
+        std::cout << nthreads << " threads: chi2 " << (chi == ref ? "identical" : "DIFFERS") << std::endl;
+        ok = ok && chi == ref;
+    }
+
+// timing: storing the values and summing them afterwards against the fused reduction
+    const int nrep = 20;
+    auto start = std::chrono::high_resolution_clock::now();
+    double s1 = 0;
+    for (int r=0; r<nrep; r++) {
+        std::vector <double> out(n);
+        vf.EvalInto(ctx, out.data());
+        double chi = 0;
+        for (size_t i=0; i<n; i++) {
+            double d = (out[i] - y[i])/sigma[i];
+            chi += d*d;
+        }
+        s1 += chi;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "EvalInto() and sum: " << std::chrono::duration <double, std::milli> (end - start).count() / nrep << " ms" << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    double s2 = 0;
+    for (int r=0; r<nrep; r++)
+        s2 += vf.Reduce(ctx, VF::ReduceChi2, nullptr, y.data(), sigma.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "Reduce():           " << std::chrono::duration <double, std::milli> (end - start).count() / nrep << " ms" << std::endl;
+    ok = ok && std::abs(s1 - s2) < 1e-9*s2;
+
+    std::cout << (ok ? "Reduction test passed" : "Reduction test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -30,6 +30,17 @@ int main(int argc, char **argv)
         return -3;
     }
 
+// a sign right after ';' or an assignment is unary (regression: was taken for a binary operation)
+    const struct {const char *expr; double value;} signs[] = {{"u=x; -u", -2.}, {"u=-x; u", -2.}, {"u=x; +u", 2.}};
+    for (const auto &s : signs) {
+        VFormula <double> vr;
+        vr.AddVariable("x");
+        if (vr.ParseExpr(s.expr) != 1024 || !vr.Validate() || vr.Eval(2.) != s.value) {
+            std::cout << "Unary sign test FAILED on " << s.expr << std::endl;
+            return -4;
+        }
+    }
+
     for (double x=-10.; x<10.1; x+=1.0) {
         std::cout << x << " \t" << vf.Eval(x) << std::endl;
     }
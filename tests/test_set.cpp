@@ -0,0 +1,94 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+
+int main()
+{
+    std::vector <std::string> exprs = {
+        "sqrt(x^2+y^2)",
+        "atan(y/x)",
+        "exp(-sqrt(x^2+y^2)/s)*cos(atan(y/x))",
+        "r=sqrt(x^2+y^2); r*sin(atan(y/x))",
+        "max(x, y)-min(x, y)",
+        "t=x*y; z=t+1",     // ends with an assignment
+        "2.5",
+        "z=t*z",            // the variables assigned above, again
+        "t*z",
+    };
+
+    VFormulaSet <double> set;
+    set.AddConstant("s", 1.7);
+    set.AddVariable("x");
+    set.AddVariable("y");
+    int errpos = set.ParseExprs(exprs);
+    if (errpos != 1024 || !set.Validate()) {
+        std::cout << "Expression " << set.GetFailedExpr() << ": " << set.GetErrorString() << " at " << errpos << std::endl;
+        return -1;
+    }
+
+// the same formulas one by one, with the assigned variables declared in advance
+    std::vector <VFormula <double>> single(exprs.size());
+    for (size_t k=0; k<exprs.size(); k++) {
+        single[k].AddConstant("s", 1.7);
+        single[k].AddVariable("x");
+        single[k].AddVariable("y");
+        single[k].AddVariable("t");
+        single[k].AddVariable("z");
+        if (single[k].ParseExpr(exprs[k]) != 1024 || !single[k].Validate()) {
+            std::cout << exprs[k] << ": " << single[k].GetErrorString() << std::endl;
+            return -1;
+        }
+    }
+
+    int mismatches = 0;
+    std::vector <double> out(set.size());
+    for (auto mode : {VFormula <double>::StackMachine, VFormula <double>::RegisterMachine}) {
+        set.SetBackend(mode);
+        for (double x : {-2., 0.5, 3.}) {
+            double y = 1. - x;
+            set.SetVariable("y", y);
+            set.EvalAll(x, out.data());
+            for (size_t k=0; k<exprs.size(); k++) {
+                single[k].SetVariable("y", y);
+                single[k].SetVariable("t", x*y);
+                single[k].SetVariable("z", k+1 < exprs.size() ? x*y+1 : x*y*(x*y+1));
+                if (out[k] != single[k].Eval(x)) {
+                    std::cout << exprs[k] << ": " << out[k] << " instead of " << single[k].Eval(x) << std::endl;
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+// an error is reported in the expression where it is
+    VFormulaSet <double> bad;
+    bad.AddVariable("x");
+    errpos = bad.ParseExprs({"x+1", "sin(x", "x"});
+    bool ok = mismatches == 0 && errpos != 1024 && bad.GetFailedExpr() == 1 && bad.size() == 0;
+
+// a set parsed again as one formula, directly, through a cache or from a program, has one output
+    VProgramCache cache(4);
+    VProgram prg;
+    single[0].GetProgram(prg);
+    for (int way=0; way<3; way++) {
+        set.SetBackend(VFormula <double>::StackMachine);
+        if (set.ParseExprs(exprs) != 1024 || set.size() != exprs.size())
+            ok = false;
+        if (way == 0)
+            errpos = set.ParseExpr("sqrt(x^2+y^2)");
+        else if (way == 1)
+            errpos = set.ParseExpr(cache, "sqrt(x^2+y^2)");
+        else
+            set.LoadProgram(prg);
+        double r = 0.;
+        set.SetVariable("y", 4.);
+        set.EvalAll(3., &r);
+        ok = ok && errpos == 1024 && set.Validate() && set.size() == 1 && r == 5.;
+    }
+
+    std::cout << "Mismatches: " << mismatches << std::endl;
+    std::cout << (ok ? "Formula set test passed" : "Formula set test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+    if (argc !=2) {
+        std::cout << "Usage example: " << argv[0] << " \"2*sin(x/10*pi)\"\n";
+        return -1;
+    }
+
+    VFormula <double> vf;
+    vf.AddConstant("pi", M_PI);
+    vf.AddVariable("x");
+
+    std::string f(argv[1]);
+    std::cout << "Expression to evaluate: " << f << std::endl;
+
+    int errpos = vf.ParseExpr(f);
+    if (errpos != 1024) {
+        std::cout << "Parsing error: " << vf.GetErrorString().c_str() << std::endl;
+        std::cout << f << std::endl;
+        std::cout << (std::string(errpos, ' ')+ "^").c_str() << std::endl;
+        return -2;
+    }
+    if (!vf.Validate()) {
+        std::cout << "Validation failed: " << vf.GetErrorString().c_str() << std::endl;
+        return -3;
+    }
+
+// the formula is parsed once and shared by all threads, each thread has its own context
+    const VFormula <double> &shared = vf;
+    int nthreads = 4;
+    int npts = 100000;
+    std::vector <std::vector<double>> results(nthreads, std::vector<double>(npts));
+    std::vector <std::thread> workers;
+
+    for (int t=0; t<nthreads; t++)
+        workers.emplace_back([&shared, &results, t, npts]() {
+            VFormula <double>::Context ctx = shared.MakeContext();
+            for (int i=0; i<npts; i++)
+                results[t][i] = shared.Eval(ctx, i*1e-4);
+        });
+    for (auto &w : workers)
+        w.join();
+
+// compare with the single-threaded evaluation
+    int mismatches = 0;
+    for (int i=0; i<npts; i++) {
+        double ref = vf.Eval(i*1e-4);
+        for (int t=0; t<nthreads; t++)
+            if (!(results[t][i] == ref) && !(std::isnan(ref) && std::isnan(results[t][i])))
+                mismatches++;
+    }
+
+    std::cout << nthreads << " threads x " << npts << " evaluations, mismatches: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : -4;
+}
@@ -0,0 +1,69 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+int main(int argc, char **argv)
+{
+    VFormula <double> vf;
+    vf.AddConstant("pi", M_PI);
+    vf.AddVariable("x");
+
+    std::string f(argc > 1 ? argv[1] : "t=x^2;2*sin(x/10*pi)+t/10");
+
+    std::cout << "Expression to evaluate: " << f << std::endl;
+
+    int errpos = vf.ParseExpr(f);
+    if (errpos != 1024) {
+        std::cout << "Parsing error: " << vf.GetErrorString().c_str() << std::endl;
+        std::cout << f << std::endl;
+        std::cout << (std::string(errpos, ' ')+ "^").c_str() << std::endl;
+        return -2;
+    }
+    if (!vf.Validate()) {
+        std::cout << "Validation failed: " << vf.GetErrorString().c_str() << std::endl;
+        return -3;
+    }
+
+    int nevals = 10000000;  // total number of evals tor run
+    std::vector <double> x(nevals), y(nevals), yref(nevals);
+    for (int i=0; i<nevals; i++)
+        x[i] = i*1e-6;
+
+// one Eval() per point
+    std::cout << "Timed run: " << nevals << " evaluations\n";
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i=0; i<nevals; i++)
+        yref[i] = vf.Eval(x[i]);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
+
+// the same in one batch; the columns of the assigned variables (t) are not needed
+    std::vector <const double*> cols(vf.GetVarMap().size(), nullptr);
+    cols[0] = x.data();
+    std::cout << "Timed batch run: " << nevals << " evaluations\n";
+    start = std::chrono::high_resolution_clock::now();
+    vf.EvalBatch(cols.data(), nevals, y.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
+
+    int mismatches = 0;
+    for (int i=0; i<nevals; i++)
+        if (!(y[i] == yref[i]) && !(std::isnan(y[i]) && std::isnan(yref[i])))
+            mismatches++;
+    std::cout << "Mismatches: " << mismatches << std::endl;
+
+// the batch with the approximate functions
+    for (auto acc : {VFormula <double>::Approx12, VFormula <double>::Approx6}) {
+        vf.SetAccuracy(acc);
+        std::cout << "Timed batch run (accuracy " << (acc == VFormula <double>::Approx12 ? "1e-12" : "1e-6")
+                  << "): " << nevals << " evaluations\n";
+        start = std::chrono::high_resolution_clock::now();
+        vf.EvalBatch(cols.data(), nevals, y.data());
+        end = std::chrono::high_resolution_clock::now();
+        std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
+    }
+    return mismatches == 0 ? 0 : -4;
+}
@@ -0,0 +1,104 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <random>
+#include <chrono>
+
+// the symbols shared by all formulas
+const int nconst = 200;
+const int nvar = 8;
+
+void Setup(VFormula <double> &vf)
+{
+    for (int i=0; i<nconst; i++)
+        vf.AddConstant("c" + std::to_string(i), 0.01*i);
+    for (int i=0; i<nvar; i++)
+        vf.AddVariable("x" + std::to_string(i));
+}
+
+// a random expression of a few terms
+std::string MakeExpr(std::mt19937 &rng)
+{
+    const char *funcs[] = {"sin", "exp", "sqrt", "log", "abs", "tanh"};
+    std::string f;
+    int nterms = 2 + rng() % 6;
+    for (int t=0; t<nterms; t++) {
+        if (t)
+            f += "+-*"[rng() % 3];
+        std::string x = "x" + std::to_string(rng() % nvar);
+        std::string c = "c" + std::to_string(rng() % nconst);
+        switch (rng() % 4) {
+            case 0: f += c + "*" + x; break;
+            case 1: f += std::string(funcs[rng() % 6]) + "(" + x + "*" + x + "+" + c + ")"; break;
+            case 2: f += "(" + x + "-" + std::to_string(rng() % 100) + ".5)^2"; break;
+            default: f += "t=" + x + "/(1+" + c + "); t*t"; f = "(" + f + ")"; break;
+        }
+    }
+    return f;
+}
+
+int main()
+{
+    const size_t nexpr = 50000;
+    std::mt19937 rng(7);
+    std::vector <std::string> exprs;
+    for (size_t i=0; i<nexpr; i++)
+        exprs.push_back(MakeExpr(rng));
+    exprs[10] = "sin(x0";     // a couple of broken ones
+    exprs[777] = "x0 + foo";
+
+// one formula per expression, each set up and parsed on its own
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector <VFormula <double>> single(nexpr);
+    std::vector <int> singlepos(nexpr);
+    for (size_t i=0; i<nexpr; i++) {
+        Setup(single[i]);
+        singlepos[i] = single[i].ParseExpr(exprs[i]);
+        if (singlepos[i] == 1024 && !single[i].Validate())
+            singlepos[i] = -1;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << nexpr << " formulas set up and parsed one by one: "
+              << std::chrono::duration <double, std::milli> (end - start).count() << " ms" << std::endl;
+
+// bulk compilation with one shared symbol table
+    VThreadPool pool;
+    start = std::chrono::high_resolution_clock::now();
+    VFormula <double> proto;
+    Setup(proto);
+    std::vector <int> errpos;
+    std::vector <VProgram> programs = proto.CompileAll(pool, exprs, errpos);
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "CompileAll() on " << pool.GetThreadCount() << " threads: "
+              << std::chrono::duration <double, std::milli> (end - start).count() << " ms" << std::endl;
+
+// the programs evaluate as the formulas parsed one by one
+    int mismatches = 0;
+    VFormula <double> vf = proto;
+    std::vector <double> x(nvar);
+    for (size_t i=0; i<nexpr; i++) {
+        if (errpos[i] != singlepos[i]) {
+            mismatches++;
+            continue;
+        }
+        if (errpos[i] != 1024)
+            continue;
+        vf.LoadProgram(programs[i]);
+        for (int k=0; k<3; k++) {
+            for (int j=0; j<nvar; j++) {
+                x[j] = 0.1*k + 0.3*j;
+                vf.SetVariable("x" + std::to_string(j), x[j]);
+                single[i].SetVariable("x" + std::to_string(j), x[j]);
+            }
+            double a = vf.Eval(x[0]), b = single[i].Eval(x[0]);
+            if (!(a == b) && !(std::isnan(a) && std::isnan(b)))
+                mismatches++;
+        }
+    }
+    bool ok = mismatches == 0 && errpos[10] != 1024 && errpos[777] != 1024;
+    std::cout << "Mismatches: " << mismatches << std::endl;
+    std::cout << (ok ? "Bulk compilation test passed" : "Bulk compilation test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+// Batch evaluation in single precision, in double precision, and with float input and output
+// computed in double
+int main(int argc, char **argv)
+{
+    std::string f(argc > 1 ? argv[1] : "a*x*x+b*x+c-x/(1+d*x)");
+    std::cout << "Expression to evaluate: " << f << std::endl;
+
+    VFormula <float> vf;
+    VFormula <double> vd;
+    const char *names[] = {"a", "b", "c", "d"};
+    const double pars[] = {0.7, -1.3, 0.1, 2.9};
+    for (int i=0; i<4; i++) {
+        vf.AddConstant(names[i], pars[i]);
+        vd.AddConstant(names[i], pars[i]);
+    }
+    vf.AddVariable("x");
+    vd.AddVariable("x");
+    if (vf.ParseExpr(f) != 1024 || !vf.Validate() || vd.ParseExpr(f) != 1024 || !vd.Validate()) {
+        std::cout << "Parsing error: " << vf.GetErrorString() << std::endl;
+        return -2;
+    }
+
+    const int n = 10000000;
+    std::vector <float> xf(n), yf(n), ymixed(n);
+    std::vector <double> xd(n), yd(n);
+    for (int i=0; i<n; i++) {
+        xf[i] = i*1e-6f;
+        xd[i] = xf[i];
+    }
+    std::vector <const float*> colsf = {xf.data()};
+    std::vector <const double*> colsd = {xd.data()};
+
+    auto start = std::chrono::high_resolution_clock::now();
+    vf.EvalBatch(colsf.data(), n, yf.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "float:                     " << std::chrono::duration <double, std::nano> (end - start).count()/n << " ns/eval" << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    vd.EvalBatch(colsd.data(), n, yd.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "double:                    " << std::chrono::duration <double, std::nano> (end - start).count()/n << " ns/eval" << std::endl;
+
+    start = std::chrono::high_resolution_clock::now();
+    vd.EvalBatch(colsf.data(), n, ymixed.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "float in and out, double:  " << std::chrono::duration <double, std::nano> (end - start).count()/n << " ns/eval" << std::endl;
+
+// the mixed results are the double ones rounded, the float ones are close to them
+    int mismatches = 0;
+    double maxerr = 0.;
+    for (int i=0; i<n; i++) {
+        if (ymixed[i] != float(yd[i]))
+            mismatches++;
+        maxerr = std::max(maxerr, std::fabs(yf[i] - yd[i]) / std::max(1., std::fabs(yd[i])));
+    }
+    std::cout << "Mixed precision mismatches: " << mismatches << ", float relative error: " << maxerr << std::endl;
+
+// the float table of constants follows SetConstant()
+    vf.SetConstant("c", 5.);
+    vd.SetConstant("c", 5.);
+    bool ok = mismatches == 0 && maxerr < 1e-5 && std::fabs(vf.Eval(1.f) - vd.Eval(1.)) < 1e-5;
+
+// the numbers folded at parsing are computed from the float table of constants as well
+    VFormula <float> folded;
+    folded.AddVariable("x");
+    ok = ok && folded.ParseExpr("x+1/3+2*(0.5-1/4)") == 1024 && folded.Validate();
+    ok = ok && std::fabs(folded.Eval(1.f) - (1.f + 1.f/3 + 0.5f)) < 1e-6;
+    std::cout << (ok ? "Float test passed" : "Float test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
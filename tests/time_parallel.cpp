@@ -0,0 +1,61 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <thread>
+
+int main(int argc, char **argv)
+{
+    VFormula <double> vf;
+    vf.AddConstant("pi", M_PI);
+    vf.AddVariable("x");
+
+    std::string f(argc > 1 ? argv[1] : "t=x^2;2*sin(x/10*pi)+t/10");
+
+    std::cout << "Expression to evaluate: " << f << std::endl;
+
+    int errpos = vf.ParseExpr(f);
+    if (errpos != 1024) {
+        std::cout << "Parsing error: " << vf.GetErrorString().c_str() << std::endl;
+        std::cout << f << std::endl;
+        std::cout << (std::string(errpos, ' ')+ "^").c_str() << std::endl;
+        return -2;
+    }
+    if (!vf.Validate()) {
+        std::cout << "Validation failed: " << vf.GetErrorString().c_str() << std::endl;
+        return -3;
+    }
+
+    int nevals = 10000000;  // total number of evals tor run
+    std::vector <double> x(nevals), y(nevals), yref(nevals);
+    for (int i=0; i<nevals; i++)
+        x[i] = i*1e-6;
+    std::vector <const double*> cols(vf.GetVarMap().size(), nullptr);
+    cols[0] = x.data();
+
+// single-threaded batch run as the reference
+    std::cout << "Timed batch run: " << nevals << " evaluations\n";
+    auto start = std::chrono::high_resolution_clock::now();
+    vf.EvalBatch(cols.data(), nevals, yref.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
+
+// the same on thread pools of different sizes
+    int mismatches = 0;
+    for (unsigned nthreads : {1u, 2u, 4u, std::thread::hardware_concurrency()}) {
+        VThreadPool pool(nthreads);
+        std::cout << "Timed parallel run on " << pool.GetThreadCount() << " threads: " << nevals << " evaluations\n";
+        start = std::chrono::high_resolution_clock::now();
+        vf.EvalParallel(pool, cols.data(), nevals, y.data());
+        end = std::chrono::high_resolution_clock::now();
+        std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
+
+        for (int i=0; i<nevals; i++)
+            if (!(y[i] == yref[i]) && !(std::isnan(y[i]) && std::isnan(yref[i])))
+                mismatches++;
+    }
+    std::cout << "Mismatches: " << mismatches << std::endl;
+    return mismatches == 0 ? 0 : -4;
+}
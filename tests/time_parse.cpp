@@ -0,0 +1,39 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// Parsing time of sums of n terms with many named constants: the time per character
+// should stay the same as the expression grows
+int main()
+{
+    const int nconst = 50;
+    for (int n : {10, 100, 1000, 4000}) {
+        std::string f;
+        for (int i=0; i<n; i++) {
+            if (i)
+                f += i%3 ? " + " : " - ";
+            f += "sin(x*" + std::to_string(i%97) + ".25)*p" + std::to_string(i%nconst) + "^2";
+        }
+
+        VFormula <double> vf;
+        vf.AddVariable("x");
+        for (int i=0; i<nconst; i++)
+            vf.AddConstant("p" + std::to_string(i), i);
+
+        int nparses = 4000/n + 1;
+        int errpos = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i=0; i<nparses; i++)
+            errpos = vf.ParseExpr(f);
+        auto end = std::chrono::high_resolution_clock::now();
+        if (errpos != 1024) {
+            std::cout << "Parsing error " << vf.GetErrorString() << " at " << errpos << std::endl;
+            return -1;
+        }
+        double us = std::chrono::duration <double, std::micro> (end - start).count()/nparses;
+        std::cout << n << " terms, " << f.size() << " characters: " << us << " us, "
+                  << us*1000/f.size() << " ns per character" << std::endl;
+    }
+    return 0;
+}
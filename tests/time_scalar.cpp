@@ -32,21 +32,41 @@ int main(int argc, char **argv)
         return -3;
     }
 
-// timed run
-    int nevals = 10000000;  // total number of evals tor run
-    std::cout << "Timed run: " << nevals << " evaluations\n";
-    double sum =  0.;
+// timed run, once for each backend
+    for (auto mode : {VFormula <double>::StackMachine, VFormula <double>::RegisterMachine}) {
+        vf.SetBackend(mode);
+        int nevals = 10000000;  // total number of evals tor run
+        std::cout << "Timed run (" << (mode == VFormula <double>::StackMachine ? "stack" : "register")
+                  << " machine): " << nevals << " evaluations\n";
+        double sum =  0.;
 
-    auto start = std::chrono::high_resolution_clock::now();
+        auto start = std::chrono::high_resolution_clock::now();
 
-//  Code to be timed
-    for (int i=0; i<nevals; i++) {
-        sum += vf.Eval(i*1e-6);
+    //  Code to be timed
+        for (int i=0; i<nevals; i++) {
+            sum += vf.Eval(i*1e-6);
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << sum << std::endl;
+        auto diff = end - start;
+        std::cout << std::chrono::duration <double, std::nano> (diff).count()/nevals << " ns/eval" << std::endl;
     }
 
+// timed run of the native code
+    if (!vf.Compile()) {
+        std::cout << "Native code is not available on this platform\n";
+        return 0;
+    }
+    int nevals = 10000000;
+    std::cout << "Timed run (native code): " << nevals << " evaluations\n";
+    double sum =  0.;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i=0; i<nevals; i++) {
+        sum += vf.EvalNative(i*1e-6);
+    }
     auto end = std::chrono::high_resolution_clock::now();
     std::cout << sum << std::endl;
-    auto diff = end - start;
-    std::cout << std::chrono::duration <double, std::nano> (diff).count()/nevals << " ns/eval" << std::endl;
+    std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
     return 0;
 }
@@ -0,0 +1,129 @@
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+// difference in units in the last place of b
+double ulps(long double a, long double b)
+{
+    if (std::isnan(a) && std::isnan(b))
+        return 0.;
+    if (a == b)
+        return 0.;
+    if (!std::isfinite(a) || !std::isfinite(b))
+        return INFINITY;
+    int exp;
+    std::frexp(b, &exp);
+    return std::fabs(a - b) / std::ldexp(1., std::max(exp, -1021) - 53);
+}
+
+// A kernel over its range against the long double functions, with the bound given in vsimd.h
+struct KernelCheck {
+    const char *mnem;
+    double lo, hi;     // range of the argument, of the base for POW
+    bool logscale;     // arguments spaced evenly in log(x)
+    double bound;      // ULP
+    long double (*ref)(long double a, long double b);
+};
+
+double MaxUlps(const KernelCheck &k, int n)
+{
+    std::vector <double> a(n), b(n), r(n);
+    for (int i=0; i<n; i++) {
+        double t = (i + 0.5) / n;
+        a[i] = k.logscale ? std::exp(std::log(k.lo) + (std::log(k.hi) - std::log(k.lo))*t) : k.lo + (k.hi - k.lo)*t;
+        b[i] = -10. + 20.*std::fmod(i*0.618034, 1.); // exponent of POW
+    }
+    VSimd::Find(k.mnem)(r.data(), a.data(), b.data(), n);
+    double maxulps = 0.;
+    for (int i=0; i<n; i++)
+        maxulps = std::max(maxulps, ulps(r[i], k.ref(a[i], b[i])));
+    return maxulps;
+}
+
+int main(int argc, char **argv)
+{
+    VFormula <double> vf;
+    vf.AddConstant("pi", M_PI);
+    vf.AddVariable("x");
+
+    std::string f(argc > 1 ? argv[1] : "exp(-x^2/2)*(2+cos(x*pi))+log(x^2+1)+tanh(x)^2*(2+sin(x))+abs(x)^1.5");
+
+    std::cout << "Expression to evaluate: " << f << std::endl;
+
+    int errpos = vf.ParseExpr(f);
+    if (errpos != 1024) {
+        std::cout << "Parsing error: " << vf.GetErrorString().c_str() << std::endl;
+        std::cout << f << std::endl;
+        std::cout << (std::string(errpos, ' ')+ "^").c_str() << std::endl;
+        return -2;
+    }
+    if (!vf.Validate()) {
+        std::cout << "Validation failed: " << vf.GetErrorString().c_str() << std::endl;
+        return -3;
+    }
+
+    int nevals = 10000000;  // total number of evals tor run
+    std::vector <double> x(nevals), y(nevals), yref(nevals), ylevel(nevals);
+    for (int i=0; i<nevals; i++)
+        x[i] = -10. + i*2e-6;
+    std::vector <const double*> cols(vf.GetVarMap().size(), nullptr);
+    cols[0] = x.data();
+
+// batch run with cmath
+    std::cout << "Timed batch run (cmath): " << nevals << " evaluations\n";
+    auto start = std::chrono::high_resolution_clock::now();
+    vf.EvalBatch(cols.data(), nevals, yref.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
+
+// the same with the SIMD kernels on every instruction set the processor has
+    vf.SetSimdMath(true);
+    int mismatches = 0;
+    double maxulps = 0.;
+    VSimd::Level best = VSimd::Detect();
+    for (int level = best; level >= VSimd::SSE2; level--) {
+        VSimd::SetLevel((VSimd::Level)level);
+        std::cout << "Timed batch run (" << VSimd::LevelName(VSimd::GetLevel()) << "): " << nevals << " evaluations\n";
+        start = std::chrono::high_resolution_clock::now();
+        vf.EvalBatch(cols.data(), nevals, y.data());
+        end = std::chrono::high_resolution_clock::now();
+        std::cout << std::chrono::duration <double, std::nano> (end - start).count()/nevals << " ns/eval" << std::endl;
+
+        for (int i=0; i<nevals; i++) {
+            maxulps = std::max(maxulps, ulps(y[i], yref[i]));
+            // every instruction set gives the same results
+            if (level != best && !(y[i] == ylevel[i]) && !(std::isnan(y[i]) && std::isnan(ylevel[i])))
+                mismatches++;
+        }
+        ylevel.swap(y);
+    }
+    VSimd::SetLevel(best);
+    std::cout << "Max difference from cmath: " << maxulps << " ULP (the errors of the kernels add up through the formula)" << std::endl;
+    std::cout << "Mismatches between instruction sets: " << mismatches << std::endl;
+
+// every kernel alone keeps the error bound of vsimd.h
+    const KernelCheck kernels[] = {
+        {"EXP", -708., 709., false, 1.2, [](long double a, long double) {return std::exp(a);}},
+        {"LOG", 1e-300, 1e300, true, 1., [](long double a, long double) {return std::log(a);}},
+        {"SIN", -10., 10., false, 1.5, [](long double a, long double) {return std::sin(a);}},
+        {"COS", -10., 10., false, 1.5, [](long double a, long double) {return std::cos(a);}},
+        {"SIN", -1e5, 1e5, false, 2.5, [](long double a, long double) {return std::sin(a);}},
+        {"COS", -1e5, 1e5, false, 2.5, [](long double a, long double) {return std::cos(a);}},
+        {"TANH", -20., 20., false, 2.5, [](long double a, long double) {return std::tanh(a);}},
+        {"POW", 1e-3, 1e3, true, 2., [](long double a, long double b) {return std::pow(a, b);}},
+    };
+    int failed = 0;
+    if (best != VSimd::None)
+        for (const KernelCheck &k : kernels) {
+            double err = MaxUlps(k, 2000000);
+            bool ok = err < k.bound;
+            std::cout << k.mnem << " [" << k.lo << ", " << k.hi << "]: max error " << err << " ULP (bound "
+                      << k.bound << ") " << (ok ? "OK" : "FAILED") << std::endl;
+            if (!ok)
+                failed++;
+        }
+    return mismatches != 0 ? -4 : failed != 0 ? -5 : 0;
+}
@@ -0,0 +1,223 @@
+#ifndef VAPPROX_H
+#define VAPPROX_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Approximations of the elementary functions for formulas which do not need full precision,
+// selected with VFormula::SetAccuracy(). Digits is the accuracy: the relative error is below
+// 10^-Digits, 12 and 6 are supported. The functions are short polynomials after the usual
+// range reduction, with no tables and no branches, so that the compiler vectorizes them over
+// blocks of a column. Arguments outside of the polynomial domains (overflow, underflow,
+// subnormals, infinities, NaN, zero and |x| > 1e5 for sin/cos, x <= 0 for pow) are passed
+// to cmath, so that the special values are the same as there.
+class VApprox
+{
+public:
+// r[i] = f(a[i], b[i]) for i < n, as VSimd::Kernel; r may be a or b
+    template <int Digits> static void Exp(double *r, const double *a, const double *, size_t n)
+    {
+        Map<ExpCore<Digits>, ExpIn, std::exp>(r, a, n);
+    }
+
+    template <int Digits> static void Log(double *r, const double *a, const double *, size_t n)
+    {
+        Map<LogCore<Digits>, LogIn, std::log>(r, a, n);
+    }
+
+    template <int Digits> static void Sin(double *r, const double *a, const double *, size_t n)
+    {
+        Map<SinCore<Digits>, SinCosIn, std::sin>(r, a, n);
+    }
+
+    template <int Digits> static void Cos(double *r, const double *a, const double *, size_t n)
+    {
+        Map<CosCore<Digits>, SinCosIn, std::cos>(r, a, n);
+    }
+
+    template <int Digits> static void Pow(double *r, const double *a, const double *b, size_t n)
+    {
+        size_t i = 0;
+        for (; i+Block <= n; i += Block)
+            PowBlock<Digits>(r+i, a+i, b+i);
+        if (i < n) {  // the last block, padded with ones
+            double x[Block], y[Block], v[Block];
+            for (size_t j=0; j<Block; j++)
+                x[j] = y[j] = 1.;
+            std::memcpy(x, a+i, (n-i)*sizeof(double));
+            std::memcpy(y, b+i, (n-i)*sizeof(double));
+            PowBlock<Digits>(v, x, y);
+            std::memcpy(r+i, v, (n-i)*sizeof(double));
+        }
+    }
+
+private:
+    static constexpr double Ln2 = 6.93147180559945286227e-01;
+    static constexpr double Ln2Hi = 6.93147180369123816490e-01;  // ln2 with the 21 lowest bits clear
+    static constexpr double Ln2Lo = 1.90821492927058770002e-10;  // ln2 - Ln2Hi
+    static constexpr double Shifter = 6755399441055744.;         // 1.5*2^52: x + Shifter rounds x to an integer
+
+    static const size_t Block = 8;
+
+    static uint64_t Bits(double x) {uint64_t u; std::memcpy(&u, &x, sizeof u); return u;}
+    static double Double(uint64_t u) {double x; std::memcpy(&x, &u, sizeof x); return x;}
+
+// The arguments for cmath are rare: the column is checked for them first, and if there are none,
+// the loop only evaluates the polynomials
+    template <double (*Core)(double), bool (*In)(double), double (*Ref)(double)>
+    static void Map(double *r, const double *a, size_t n)
+    {
+        int in = 1;
+        for (size_t i=0; i<n; i++)
+            in &= In(a[i]);
+        if (in) {
+            // blocks of fixed length are vectorized already at -O2; r[i] depends only on a[i]
+            size_t i = 0;
+            for (; i+Block <= n; i += Block) {
+                double v[Block];
+                for (size_t j=0; j<Block; j++)
+                    v[j] = Core(a[i+j]);
+                std::memcpy(r+i, v, sizeof v);
+            }
+            for (; i<n; i++)
+                r[i] = Core(a[i]);
+        } else
+            for (size_t i=0; i<n; i++)
+                r[i] = In(a[i]) ? Core(a[i]) : Ref(a[i]);
+    }
+
+// x = k*ln2 + r, |r| <= ln2/2: exp(x) = 2^k * exp(r)
+    static bool ExpIn(double x) {return std::fabs(x) <= 708.;}  // false for NaN
+
+    template <int Digits> static double ExpCore(double x)
+    {
+        double t = x * 1.44269504088896338700 + Shifter;  // the low bits of t are k = x/ln2 rounded
+        double k = t - Shifter;
+        double r = (x - k*Ln2Hi) - k*Ln2Lo;
+        double p;
+        if constexpr(Digits > 6)  // Taylor series to r^10: error < 2.2e-13
+            p = 1. + r*(1. + r*(1./2 + r*(1./6 + r*(1./24 + r*(1./120 + r*(1./720 + r*(1./5040 +
+                r*(1./40320 + r*(1./362880 + r*(1./3628800))))))))));
+        else                      // to r^6: error < 1.2e-7
+            p = 1. + r*(1. + r*(1./2 + r*(1./6 + r*(1./24 + r*(1./120 + r*(1./720))))));
+        return p * Double((Bits(t) + 1023) << 52);
+    }
+
+// x = 2^k * m with m in [sqrt(1/2), sqrt(2)): log(x) = k*ln2 + 2*atanh(s), s = (m-1)/(m+1)
+    static bool LogIn(double x) {return (x >= 2.2250738585072014e-308) & (x <= 1.7976931348623157e308);}
+
+    static double LogMantissa(double x, double &k)
+    {
+        // subtracting the bits of sqrt(1/2) moves the boundary of the exponent there
+        uint64_t t = Bits(x) - 0x3fe6a09e667f3bcdULL;
+        k = Double(Bits(Shifter) + ((t + (1024ULL << 52)) >> 52)) - (Shifter + 1024.);
+        return Double(Bits(x) - (t & 0xfff0000000000000ULL));
+    }
+
+// atanh(s)/s as a series in z = s^2 <= 0.0295, to the number of terms for the accuracy
+    template <int Digits> static double Atanh(double z)
+    {
+        if constexpr(Digits > 12)      // to z^9: error < 2.3e-17
+            return 1. + z*(1./3 + z*(1./5 + z*(1./7 + z*(1./9 + z*(1./11 + z*(1./13 + z*(1./15 +
+                   z*(1./17 + z*(1./19)))))))));
+        else if constexpr(Digits > 9)  // to z^7: error < 3.3e-14
+            return 1. + z*(1./3 + z*(1./5 + z*(1./7 + z*(1./9 + z*(1./11 + z*(1./13 + z*(1./15)))))));
+        else if constexpr(Digits > 6)  // to z^5: error < 5e-11
+            return 1. + z*(1./3 + z*(1./5 + z*(1./7 + z*(1./9 + z*(1./11)))));
+        else                           // to z^3: error < 8.3e-8
+            return 1. + z*(1./3 + z*(1./5 + z*(1./7)));
+    }
+
+    template <int Digits> static double LogCore(double x)
+    {
+        double k;
+        double m = LogMantissa(x, k);
+        double s = (m - 1.) / (m + 1.);
+        return k*Ln2 + 2.*s*Atanh<Digits>(s*s);
+    }
+
+// pow(x, y) = exp(y*log(x)): the absolute error of y*log(x) becomes the relative error of the result,
+// so the logarithm takes three more digits, as |y*log(x)| < 709 where the result is finite
+    template <int Digits> static double PowLog(double x, double y)
+    {
+        return y * LogCore<Digits+3>(x);
+    }
+
+// Whether y*log(x) is in the domain of exp is known only after the logarithm:
+// such points are recomputed with cmath before the block is stored
+    template <int Digits> static void PowBlock(double *r, const double *x, const double *y)
+    {
+        double z[Block], v[Block];
+        for (size_t j=0; j<Block; j++) {
+            z[j] = PowLog<Digits>(x[j], y[j]);
+            v[j] = ExpCore<Digits>(z[j]);
+        }
+        int in = 1;
+        for (size_t j=0; j<Block; j++)
+            in &= LogIn(x[j]) & ExpIn(z[j]);
+        if (!in)
+            for (size_t j=0; j<Block; j++)
+                if (!LogIn(x[j]) || !ExpIn(z[j]))
+                    v[j] = std::pow(x[j], y[j]);
+        std::memcpy(r, v, sizeof v);
+    }
+
+// x = q*pi/2 + r, |r| <= pi/4; pi/2 in three parts, the first two with 33 significant bits,
+// so that q*Pio2_1 and q*Pio2_2 are exact for |q| < 2^20
+    static bool SinCosIn(double x) {return (std::fabs(x) <= 1e5) & (x != 0.);}  // cmath keeps the sign of zero
+
+    static double Reduce(double x, uint64_t &q)
+    {
+        const double InvPio2 = 6.36619772367581382433e-01;
+        const double Pio2_1 = 1.57079632673412561417e+00;
+        const double Pio2_2 = 6.07710050630396597660e-11;
+        const double Pio2_3 = 2.02226624871116645580e-21;
+        double t = x * InvPio2 + Shifter;
+        double k = t - Shifter;
+        q = Bits(t);  // q & 3 is the quadrant
+        return ((x - k*Pio2_1) - k*Pio2_2) - k*Pio2_3;
+    }
+
+// Taylor series on |r| <= pi/4
+    template <int Digits> static double SinPoly(double r)
+    {
+        double z = r*r;
+        if constexpr(Digits > 6)  // to r^13: error < 2.6e-14
+            return r + r*z*(-1./6 + z*(1./120 + z*(-1./5040 + z*(1./362880 + z*(-1./39916800 +
+                   z*(1./6227020800))))));
+        else                      // to r^7: error < 4e-7
+            return r + r*z*(-1./6 + z*(1./120 + z*(-1./5040)));
+    }
+
+    template <int Digits> static double CosPoly(double r)
+    {
+        double z = r*r;
+        if constexpr(Digits > 6)  // to r^14: error < 1.5e-15
+            return 1. + z*(-1./2 + z*(1./24 + z*(-1./720 + z*(1./40320 + z*(-1./3628800 +
+                   z*(1./479001600 + z*(-1./87178291200)))))));
+        else                      // to r^8: error < 3.5e-8
+            return 1. + z*(-1./2 + z*(1./24 + z*(-1./720 + z*(1./40320))));
+    }
+
+    template <int Digits> static double SinCore(double x)
+    {
+        uint64_t q;
+        double r = Reduce(x, q);
+        double s = SinPoly<Digits>(r), c = CosPoly<Digits>(r);
+        uint64_t odd = 0 - (q & 1);  // masks instead of branches
+        return Double(((Bits(c) & odd) | (Bits(s) & ~odd)) ^ ((q & 2) << 62));
+    }
+
+    template <int Digits> static double CosCore(double x)
+    {
+        uint64_t q;
+        double r = Reduce(x, q);
+        double s = SinPoly<Digits>(r), c = CosPoly<Digits>(r);
+        uint64_t odd = 0 - (q & 1);
+        return Double(((Bits(s) & odd) | (Bits(c) & ~odd)) ^ (((q + 1) & 2) << 62));
+    }
+};
+
+#endif // VAPPROX_H
@@ -0,0 +1,316 @@
+#include "vbundle.h"
+#include "vformula.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VBUNDLE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char Magic[4] = {'V', 'F', 'P', 'B'};
+const uint32_t ByteOrder = 0x01020304;
+const size_t HeaderSize = 64;
+
+// header fields, offsets in bytes
+enum {
+    HdrVersion = 4,
+    HdrByteOrder = 8,
+    HdrCount = 12,
+    HdrFingerprint = 16,
+    HdrSize = 24,
+    HdrChecksum = 32,
+    HdrSymbols = 40,
+    HdrDirectory = 48
+};
+
+// FNV-1a over 64-bit words; n is a multiple of 8
+uint64_t Checksum(const unsigned char *p, size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i=0; i<n; i+=8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    return h;
+}
+
+struct Writer {
+    std::vector <unsigned char> buf;
+
+    template <typename T>
+    void Put(T v)
+    {
+        size_t pos = buf.size();
+        buf.resize(pos + sizeof v);
+        std::memcpy(&buf[pos], &v, sizeof v);
+    }
+    template <typename T>
+    void Set(size_t pos, T v) {std::memcpy(&buf[pos], &v, sizeof v);}
+    void PutName(const std::string &name)
+    {
+        Put<uint32_t>(name.size());
+        buf.insert(buf.end(), name.begin(), name.end());
+    }
+    void Align() {buf.resize((buf.size() + 7) / 8 * 8);}
+};
+
+// reads from the mapped file; on reading past the end ok is cleared and zeros are returned
+struct Reader {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    bool ok = true;
+
+    Reader(const unsigned char *d, size_t s, size_t p) : data(d), size(s), pos(p) {;}
+
+    bool Fits(uint64_t n)
+    {
+        if (pos > size || n > size - pos)
+            ok = false;
+        return ok;
+    }
+    template <typename T>
+    T Get()
+    {
+        T v{};
+        if (!Fits(sizeof v))
+            return v;
+        std::memcpy(&v, data + pos, sizeof v);
+        pos += sizeof v;
+        return v;
+    }
+    std::string GetName()
+    {
+        uint32_t n = Get<uint32_t>();
+        if (!Fits(n))
+            return std::string();
+        std::string name((const char*)data + pos, n);
+        pos += n;
+        return name;
+    }
+    void Align() {pos = (pos + 7) / 8 * 8;}
+};
+
+} // namespace
+
+bool VProgramBundle::Save(const std::string &path, const VParser &symbols, const std::vector <VProgram> &programs)
+{
+    Writer w;
+    w.buf.resize(HeaderSize);
+
+    uint64_t symoffset = w.buf.size();
+    size_t nconst = symbols.ConstName.size();
+    w.Put<uint32_t>(nconst);
+    w.Put<uint32_t>(symbols.VarName.size());
+    for (size_t i=0; i<nconst; i++)
+        w.Put<double>(symbols.Const[i]);
+    for (const std::string &name : symbols.ConstName)
+        w.PutName(name);
+    for (const std::string &name : symbols.VarName)
+        w.PutName(name);
+    w.Align();
+
+    uint64_t diroffset = w.buf.size();
+    w.buf.resize(diroffset + 8 * programs.size());
+    for (size_t i=0; i<programs.size(); i++) {
+        const VProgram &prg = programs[i];
+        w.Align();
+        w.Set<uint64_t>(diroffset + 8*i, w.buf.size());
+        w.Put<uint32_t>(prg.Command.size());
+        w.Put<uint32_t>(prg.AutoConst.size());
+        w.Put<uint32_t>(prg.RegCode.size());
+        w.Put<uint32_t>(prg.VarName.size());
+        w.Put<uint32_t>(prg.HoistCode.size());
+        w.Put<uint32_t>(0);
+        w.Put<uint64_t>(prg.RegCount);
+        w.Put<uint64_t>(prg.StackDepth);
+        for (const auto *code : {&prg.Command, &prg.HoistCode})
+            for (const VParser::Cmdaddr &c : *code) {
+                w.Put<uint16_t>(c.cmd);
+                w.Put<uint16_t>(c.addr);
+            }
+        w.Align();
+        for (double val : prg.AutoConst)
+            w.Put<double>(val);
+        for (const VParser::RegCmd &c : prg.RegCode) {
+            w.Put<uint16_t>(c.cmd);
+            w.Put<uint16_t>(c.addr);
+            w.Put<uint16_t>(c.dst);
+            w.Put<uint16_t>(c.a);
+            w.Put<uint16_t>(c.b);
+        }
+        for (const std::string &name : prg.VarName)
+            w.PutName(name);
+    }
+    w.Align();
+
+    std::memcpy(w.buf.data(), Magic, sizeof Magic);
+    w.Set<uint32_t>(HdrVersion, Version);
+    w.Set<uint32_t>(HdrByteOrder, ByteOrder);
+    w.Set<uint32_t>(HdrCount, programs.size());
+    w.Set<uint64_t>(HdrFingerprint, symbols.GetFingerprint());
+    w.Set<uint64_t>(HdrSize, w.buf.size());
+    w.Set<uint64_t>(HdrSymbols, symoffset);
+    w.Set<uint64_t>(HdrDirectory, diroffset);
+    w.Set<uint64_t>(HdrChecksum, Checksum(w.buf.data() + HeaderSize, w.buf.size() - HeaderSize));
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write((const char*)w.buf.data(), w.buf.size());
+    out.close();
+    if (!out)
+        return Fail("Can not write " + path);
+    return true;
+}
+
+bool VProgramBundle::Open(const std::string &path, bool verify)
+{
+    Close();
+#ifdef VBUNDLE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return Fail("Can not open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)HeaderSize) {
+        close(fd);
+        return Fail("Not a program bundle: " + path);
+    }
+    size_t size = st.st_size;
+    void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return Fail("Can not map " + path);
+    Mapping = std::shared_ptr <const void> (p, [size](const void *q) {munmap(const_cast<void*>(q), size);});
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return Fail("Can not open " + path);
+    auto buf = std::make_shared <std::vector <unsigned char>> (std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    size_t size = buf->size();
+    const void *p = buf->data();
+    Mapping = buf;
+#endif
+    Data = (const unsigned char*)p;
+    Size = size;
+
+    Reader r(Data, Size, sizeof Magic);
+    if (Size < HeaderSize || std::memcmp(Data, Magic, sizeof Magic) != 0)
+        return Fail("Not a program bundle: " + path);
+    FileVersion = r.Get<uint32_t>();
+    if (FileVersion == 0 || FileVersion > Version)
+        return Fail("Unsupported version of the program bundle: " + std::to_string(FileVersion));
+    if (r.Get<uint32_t>() != ByteOrder)
+        return Fail("The program bundle was written on a machine with a different byte order");
+    Count = r.Get<uint32_t>();
+    Fingerprint = r.Get<uint64_t>();
+    uint64_t size64 = r.Get<uint64_t>();
+    uint64_t checksum = r.Get<uint64_t>();
+    uint64_t symoffset = r.Get<uint64_t>();
+    DirOffset = r.Get<uint64_t>();
+    if (size64 != Size || Size % 8 != 0)
+        return Fail("The program bundle is truncated");
+    if (verify && Checksum(Data + HeaderSize, Size - HeaderSize) != checksum)
+        return Fail("Checksum mismatch: the program bundle is corrupted");
+    if (DirOffset > Size || Count > (Size - DirOffset) / 8)
+        return Fail("Corrupted directory of the program bundle");
+
+    r.pos = symoffset;
+    uint32_t nconst = r.Get<uint32_t>();
+    uint32_t nvar = r.Get<uint32_t>();
+    if (!r.Fits(8 * (uint64_t)nconst))
+        return Fail("Corrupted symbols of the program bundle");
+    for (uint32_t i=0; i<nconst; i++)
+        ConstValues.push_back(r.Get<double>());
+    for (uint32_t i=0; i<nconst && r.ok; i++)
+        ConstNames.push_back(r.GetName());
+    for (uint32_t i=0; i<nvar && r.ok; i++)
+        VarNames.push_back(r.GetName());
+    if (!r.ok)
+        return Fail("Corrupted symbols of the program bundle");
+    return true;
+}
+
+void VProgramBundle::Close()
+{
+    Mapping.reset();
+    Data = nullptr;
+    Size = 0;
+    FileVersion = 0;
+    Count = 0;
+    DirOffset = 0;
+    Fingerprint = 0;
+    ConstNames.clear();
+    ConstValues.clear();
+    VarNames.clear();
+}
+
+bool VProgramBundle::Fail(const std::string &msg)
+{
+    Close();
+    ErrorString = msg;
+    return false;
+}
+
+bool VProgramBundle::GetProgram(size_t i, VProgram &prg) const
+{
+    if (i >= Count)
+        return false;
+    Reader r(Data, Size, DirOffset + 8*i);
+    r.pos = r.Get<uint64_t>();
+    uint32_t ncmd = r.Get<uint32_t>();
+    uint32_t nauto = r.Get<uint32_t>();
+    uint32_t nreg = r.Get<uint32_t>();
+    uint32_t nvar = r.Get<uint32_t>();
+    uint32_t nhoist = 0;
+    if (FileVersion >= 2) {
+        nhoist = r.Get<uint32_t>();
+        r.Get<uint32_t>();
+    }
+    prg.RegCount = r.Get<uint64_t>();
+    prg.StackDepth = r.Get<uint64_t>();
+    if (!r.Fits(4 * ((uint64_t)ncmd + nhoist)))
+        return false;
+
+    for (auto code : {std::make_pair(&prg.Command, ncmd), std::make_pair(&prg.HoistCode, nhoist)}) {
+        code.first->clear();
+        code.first->reserve(code.second);
+        for (uint32_t k=0; k<code.second; k++) {
+            uint16_t cmd = r.Get<uint16_t>();
+            code.first->emplace_back(cmd, r.Get<uint16_t>());
+        }
+    }
+    r.Align();
+    if (!r.Fits(8 * (uint64_t)nauto + 10 * (uint64_t)nreg))
+        return false;
+    prg.AutoConst.resize(nauto);
+    for (double &val : prg.AutoConst)
+        val = r.Get<double>();
+    prg.RegCode.resize(nreg);
+    for (VParser::RegCmd &c : prg.RegCode) {
+        c.cmd = r.Get<uint16_t>();
+        c.addr = r.Get<uint16_t>();
+        c.dst = r.Get<uint16_t>();
+        c.a = r.Get<uint16_t>();
+        c.b = r.Get<uint16_t>();
+    }
+    prg.VarName.clear();
+    for (uint32_t k=0; k<nvar && r.ok; k++)
+        prg.VarName.push_back(r.GetName());
+    return r.ok;
+}
+
+bool VProgramBundle::Setup(VParser &vf) const
+{
+    for (size_t i=0; i<ConstNames.size(); i++)
+        vf.AddConstant(ConstNames[i], ConstValues[i]);
+    for (const std::string &name : VarNames)
+        vf.AddVariable(name);
+    return vf.GetFingerprint() == Fingerprint;
+}
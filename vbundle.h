@@ -0,0 +1,78 @@
+#ifndef VBUNDLE_H
+#define VBUNDLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class VParser;
+struct VProgram; // a parsed and validated program, defined in vformula.h
+
+// A file of compiled programs (VProgram, e.g. from VFormula::CompileAll()) together with the
+// named constants and the declared variables of the formula which compiled them.
+//
+// Layout, all numbers in the byte order of the writer (checked by the reader):
+//   header, 64 bytes: "VFPB", version, byte order mark 0x01020304, number of programs,
+//       fingerprint of the symbol tables (VParser::GetFingerprint()), file size,
+//       checksum (FNV-1a over the 64-bit words after the header), offsets of the symbols and of the directory
+//   symbols: number of constants and of variables, values of the constants, names
+//   directory: offset of every program
+//   programs: sizes, commands, hoisted commands (since version 2), auto constants, register code,
+//       names of the variables
+// Every section starts at a multiple of 8 bytes, names are a 32-bit length followed by the characters.
+//
+// Open() maps the file into memory, so that thousands of programs can be opened at once: only the
+// symbols are decoded, GetProgram() reads the program it is asked for directly from the mapping.
+// The programs were validated before they were saved and the checksum guarantees that they arrive
+// unchanged, so they are loaded with VFormula::LoadProgram() without Validate().
+class VProgramBundle
+{
+public:
+    static const uint32_t Version = 2;
+
+    VProgramBundle() {;}
+    ~VProgramBundle() {Close();}
+    VProgramBundle(const VProgramBundle &) = delete;
+    VProgramBundle &operator=(const VProgramBundle &) = delete;
+
+// writes the programs and the constants and variables of symbols (the formula which compiled them)
+    bool Save(const std::string &path, const VParser &symbols, const std::vector <VProgram> &programs);
+
+// Maps the file and checks the header, the version and, if verify is set, the checksum.
+// Without the check the file must be trusted: only the offsets are checked on reading.
+    bool Open(const std::string &path, bool verify = true);
+    void Close();
+    bool IsOpen() const {return Data != nullptr;}
+
+    size_t size() const {return Count;} // number of programs
+    bool GetProgram(size_t i, VProgram &prg) const;
+
+    uint64_t GetFingerprint() const {return Fingerprint;}
+    const std::vector <std::string> &GetConstNames() const {return ConstNames;}
+    const std::vector <double> &GetConstValues() const {return ConstValues;}
+    const std::vector <std::string> &GetVarNames() const {return VarNames;}
+// adds the constants and variables of the file to the formula; true if its symbol tables
+// then match those the programs were compiled with
+    bool Setup(VParser &vf) const;
+
+    std::string GetErrorString() const {return ErrorString;}
+
+private:
+    bool Fail(const std::string &msg);
+
+    const unsigned char *Data = nullptr; // the mapped file
+    size_t Size = 0;
+    std::shared_ptr <const void> Mapping; // unmaps or frees the file contents
+    uint32_t FileVersion = 0;
+    size_t Count = 0;
+    uint64_t DirOffset = 0;
+    uint64_t Fingerprint = 0;
+    std::vector <std::string> ConstNames;
+    std::vector <double> ConstValues;
+    std::vector <std::string> VarNames;
+    std::string ErrorString;
+};
+
+#endif // VBUNDLE_H
@@ -0,0 +1,63 @@
+#include "vcache.h"
+
+VProgramCache::VProgramCache(size_t capacity) : Capacity(capacity > 0 ? capacity : 1)
+{
+}
+
+// the fingerprint as 8 raw bytes followed by the expression
+std::string VProgramCache::Key(uint64_t fingerprint, const std::string &expr)
+{
+    std::string key(sizeof fingerprint, '\0');
+    for (size_t i=0; i<sizeof fingerprint; i++)
+        key[i] = (char)(fingerprint >> 8*i);
+    return key + expr;
+}
+
+std::shared_ptr <const VProgram> VProgramCache::Find(uint64_t fingerprint, const std::string &expr)
+{
+    std::string key = Key(fingerprint, expr);
+    std::lock_guard <std::mutex> lock(Mutex);
+    auto itr = Index.find(key);
+    if (itr == Index.end()) {
+        Counters.misses++;
+        return nullptr;
+    }
+    Counters.hits++;
+    Entries.splice(Entries.begin(), Entries, itr->second); // now the most recently used
+    return itr->second->second;
+}
+
+void VProgramCache::Insert(uint64_t fingerprint, const std::string &expr, std::shared_ptr <const VProgram> prg)
+{
+    std::string key = Key(fingerprint, expr);
+    std::lock_guard <std::mutex> lock(Mutex);
+    auto itr = Index.find(key);
+    if (itr != Index.end()) { // another thread was faster
+        itr->second->second = prg;
+        Entries.splice(Entries.begin(), Entries, itr->second);
+        return;
+    }
+    if (Entries.size() >= Capacity) {
+        Index.erase(Entries.back().first);
+        Entries.pop_back();
+        Counters.evictions++;
+    }
+    Entries.emplace_front(key, prg);
+    Index.emplace(key, Entries.begin());
+}
+
+VProgramCache::Stats VProgramCache::GetStats() const
+{
+    std::lock_guard <std::mutex> lock(Mutex);
+    Stats stats = Counters;
+    stats.size = Entries.size();
+    return stats;
+}
+
+void VProgramCache::Clear()
+{
+    std::lock_guard <std::mutex> lock(Mutex);
+    Entries.clear();
+    Index.clear();
+    Counters = Stats();
+}
@@ -0,0 +1,53 @@
+#ifndef VCACHE_H
+#define VCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct VProgram; // a parsed and validated program, defined in vformula.h
+
+// Bounded cache of parsed programs, shared by any number of formulas and threads. The key is
+// the expression text together with the fingerprint of everything else the result of parsing
+// depends on (symbol tables, VarType; see VFormula::ParseExpr(VProgramCache&, ...)).
+// When full, the least recently used program is evicted. All members are thread-safe.
+class VProgramCache
+{
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t size = 0;    // programs in the cache
+    };
+
+    explicit VProgramCache(size_t capacity = 1024);
+    VProgramCache(const VProgramCache &) = delete;
+    VProgramCache &operator=(const VProgramCache &) = delete;
+
+    size_t GetCapacity() const {return Capacity;}
+
+// the program for the key, nullptr if there is none; counts a hit or a miss
+    std::shared_ptr <const VProgram> Find(uint64_t fingerprint, const std::string &expr);
+// adds or replaces the program for the key
+    void Insert(uint64_t fingerprint, const std::string &expr, std::shared_ptr <const VProgram> prg);
+
+    Stats GetStats() const;
+    void Clear(); // removes the programs and resets the counters
+
+private:
+    typedef std::pair <std::string, std::shared_ptr <const VProgram>> Entry;
+    static std::string Key(uint64_t fingerprint, const std::string &expr);
+
+    const size_t Capacity;
+    mutable std::mutex Mutex;    // protects the fields below
+    std::list <Entry> Entries;   // most recently used first
+    std::unordered_map <std::string, std::list <Entry>::iterator> Index;
+    Stats Counters;
+};
+
+#endif // VCACHE_H
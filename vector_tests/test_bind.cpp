@@ -0,0 +1,128 @@
+// Eigen checks every heap allocation when EIGEN_RUNTIME_NO_MALLOC is defined:
+// with set_is_malloc_allowed(false) an allocation triggers an assertion
+#define EIGEN_RUNTIME_NO_MALLOC
+#include <Eigen/Dense>
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <chrono>
+
+typedef VFormula <Eigen::ArrayXd> VF;
+
+struct Point {
+    float w;
+    double x, y;
+};
+
+int main()
+{
+    const std::string f = "a*exp(-x*x/2)+sin(y)*x";
+    VF vf;
+    vf.AddConstant("a", 1.5);
+    vf.AddVariable("x");
+    vf.AddVariable("y");
+    if (vf.ParseExpr(f) != 1024 || !vf.Validate()) {
+        std::cout << "Can not parse " << f << ": " << vf.GetErrorString() << std::endl;
+        return -1;
+    }
+    std::cout << "Expression to evaluate: " << f << std::endl;
+
+    const size_t x = vf.GetSlot("x"), y = vf.GetSlot("y");
+    bool ok = x == 0 && y == 1 && vf.GetSlot("z") == VF::NoSlot;
+
+// the buffers bound to x and y are read in place, the result goes to the caller's buffer
+    int mismatches = 0;
+    for (int pts : {1000, 10007}) {
+        std::vector <double> xbuf(pts), ybuf(pts), out(pts);
+        for (int i=0; i<pts; i++) {
+            xbuf[i] = -5. + 10.*i/pts;
+            ybuf[i] = 0.3*i;
+        }
+        Eigen::Map <const Eigen::ArrayXd> xmap(xbuf.data(), pts);
+        Eigen::ArrayXd ymap = Eigen::Map <const Eigen::ArrayXd> (ybuf.data(), pts);
+
+        for (auto mode : {VF::StackMachine, VF::RegisterMachine}) {
+            vf.SetBackend(mode);
+            VF::Context ctx = vf.MakeContext();
+            Eigen::ArrayXd ref = vf.Eval(ctx, xmap, ymap);
+
+            ok = ok && vf.Bind(ctx, x, xmap) && vf.Bind(ctx, y, ybuf.data(), pts);
+            ok = ok && !vf.Bind(ctx, y, ybuf.data(), pts-1); // all buffers have the same length
+            vf.EvalInto(ctx, out.data()); // the first call sizes the tiles of the context
+
+            Eigen::internal::set_is_malloc_allowed(false);
+            for (int i=0; i<10; i++)
+                vf.EvalInto(ctx, out.data());
+            Eigen::internal::set_is_malloc_allowed(true);
+
+            for (int i=0; i<pts; i++)
+                if (out[i] != ref[i])
+                    mismatches++;
+            std::cout << pts << " points, " << (mode == VF::StackMachine ? "stack machine" : "register machine")
+                      << ": no allocations" << std::endl;
+
+        // the same points as an array of records, gathered tile by tile
+            std::vector <Point> points(pts);
+            for (int i=0; i<pts; i++)
+                points[i] = {1.f, xbuf[i], ybuf[i]};
+            vf.Unbind(ctx);
+            ok = ok && vf.Bind(ctx, x, points.data(), &Point::x, pts) && vf.Bind(ctx, y, points.data(), &Point::y, pts);
+            vf.EvalInto(ctx, out.data());
+            for (int i=0; i<pts; i++)
+                if (out[i] != ref[i])
+                    mismatches++;
+        }
+    }
+    vf.SetBackend(VF::StackMachine);
+
+// scalar formula: the bound buffers are the columns of the batch evaluation
+    VFormula <double> sf;
+    sf.AddConstant("a", 1.5);
+    sf.AddVariable("x");
+    sf.AddVariable("y");
+    ok = ok && sf.ParseExpr(f) == 1024 && sf.Validate();
+    {
+        const size_t pts = 1000;
+        std::vector <double> xbuf(pts), out(pts);
+        for (size_t i=0; i<pts; i++)
+            xbuf[i] = 0.01*i;
+        VFormula <double>::Context ctx = sf.MakeContext();
+        sf.SetVariable(ctx, sf.GetSlot("y"), 0.7); // not bound: taken from the context
+        ok = ok && sf.Bind(ctx, sf.GetSlot("x"), xbuf);
+        sf.EvalInto(ctx, out.data());
+        for (size_t i=0; i<pts; i++)
+            if (out[i] != sf.Eval(ctx, xbuf[i], 0.7))
+                mismatches++;
+    }
+    std::cout << "Mismatches: " << mismatches << std::endl;
+    ok = ok && mismatches == 0;
+
+// timing: copying the inputs into the context against binding them
+    const int pts = 1000000, nrep = 20;
+    Eigen::ArrayXd xv = Eigen::ArrayXd::LinSpaced(pts, -5., 5.), yv = Eigen::ArrayXd::LinSpaced(pts, 0., 100.);
+    Eigen::ArrayXd res(pts);
+    VF::Context ctx = vf.MakeContext();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i=0; i<nrep; i++)
+        res = vf.Eval(ctx, xv, yv);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Eval(x, y):       " << std::chrono::duration <double, std::milli> (end - start).count() / nrep << " ms" << std::endl;
+
+    vf.Bind(ctx, x, xv);
+    vf.Bind(ctx, y, yv);
+    start = std::chrono::high_resolution_clock::now();
+    for (int i=0; i<nrep; i++)
+        vf.EvalInto(ctx, res.data());
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "Bind(), EvalInto: " << std::chrono::duration <double, std::milli> (end - start).count() / nrep << " ms" << std::endl;
+
+// the fused sum over the bound buffers agrees with that of the stored results
+    double sum = vf.Reduce(ctx, VF::ReduceSum);
+    std::cout << "Reduce(): sum " << sum << ", stored results " << res.sum() << std::endl;
+    ok = ok && std::abs(sum - res.sum()) < 1e-12*std::abs(sum);
+
+    std::cout << (ok ? "Binding test passed" : "Binding test FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
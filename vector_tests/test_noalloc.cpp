@@ -0,0 +1,59 @@
+// Eigen checks every heap allocation when EIGEN_RUNTIME_NO_MALLOC is defined:
+// with set_is_malloc_allowed(false) an allocation triggers an assertion
+#define EIGEN_RUNTIME_NO_MALLOC
+#include <Eigen/Dense>
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <cmath>
+
+int main(int argc, char **argv)
+{
+    if (argc !=2) {
+        std::cout << "Usage example: " << argv[0] << " \"2*sin(x/10*pi)\"\n";
+        return -1;
+    }
+
+    VFormula <Eigen::ArrayXd> vf;
+    vf.AddConstant("pi", M_PI);
+    vf.AddVariable("x");
+
+    std::string f(argv[1]);
+    std::cout << "Expression to evaluate: " << f << std::endl;
+
+    int errpos = vf.ParseExpr(f);
+    if (errpos != 1024) {
+        std::cout << "Parsing error: " << vf.GetErrorString().c_str() << std::endl;
+        std::cout << f << std::endl;
+        std::cout << (std::string(errpos, ' ')+ "^").c_str() << std::endl;
+        return -2;
+    }
+    if (!vf.Validate()) {
+        std::cout << "Validation failed: " << vf.GetErrorString().c_str() << std::endl;
+        return -3;
+    }
+
+// the second length is above the tile size, so it is evaluated tile by tile
+    for (int pts : {1000, 10007}) {
+        Eigen::ArrayXd x(pts), y(pts), ref(pts);
+        x.setLinSpaced(pts, -10., 10.);
+
+        for (auto mode : {VFormula<Eigen::ArrayXd>::StackMachine, VFormula<Eigen::ArrayXd>::RegisterMachine}) {
+            vf.SetBackend(mode);
+            VFormula <Eigen::ArrayXd>::Context ctx = vf.MakeContext();
+            vf.EvalInto(ctx, x, ref); // the first call sizes the stack/registers of the context
+
+            Eigen::internal::set_is_malloc_allowed(false);
+            for (int i=0; i<100; i++)
+                vf.EvalInto(ctx, x, y);
+            Eigen::internal::set_is_malloc_allowed(true);
+
+            std::cout << pts << " points, " << (mode == VFormula<Eigen::ArrayXd>::StackMachine ? "stack machine" : "register machine")
+                      << ": no allocations, max difference " << (y - ref).abs().maxCoeff() << std::endl;
+        }
+    }
+
+    std::cout << "Done!\n";
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <Eigen/Dense>
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <random>
+
+// relative difference of a from the exact value b
+double relerr(double a, double b)
+{
+    if (std::isnan(a) && std::isnan(b))
+        return 0.;
+    if (a == b)
+        return std::signbit(a) == std::signbit(b) ? 0. : 1.;
+    return std::fabs(a - b) / std::fabs(b);
+}
+
+struct Case {
+    const char *expr;
+    double xmin, xmax;   // x is uniform in [xmin, xmax], or exp() of that if logx
+    bool logx;
+    double ymin, ymax;
+};
+
+int main()
+{
+    typedef VFormula <Eigen::ArrayXd> VF;
+    std::vector <Case> cases = {
+        {"exp(x)",      -750., 750.,   false, 0., 0.},
+        {"log(x)",      -700., 700.,   true,  0., 0.},
+        {"sin(x)",      -1e5,  1e5,    false, 0., 0.},
+        {"cos(x)",      -1e5,  1e5,    false, 0., 0.},
+        {"x^y",         -5.,   5.,     true,  -100., 100.},
+    };
+    const int npts = 100003;  // long enough to be evaluated in tiles
+
+    int failed = 0;
+    std::mt19937_64 rng(12345);
+    for (const Case &c : cases) {
+        std::uniform_real_distribution <double> ux(c.xmin, c.xmax), uy(c.ymin, c.ymax);
+        Eigen::ArrayXd x(npts), y(npts);
+        for (int i=0; i<npts; i++) {
+            x[i] = c.logx ? std::exp(ux(rng)) : ux(rng);
+            y[i] = uy(rng);
+        }
+        x[0] = 0.; x[1] = -0.; x[2] = INFINITY; x[3] = NAN; x[4] = 1.;  // special values
+
+        VF vf;
+        vf.AddVariable("x");
+        vf.AddVariable("y");
+        if (vf.ParseExpr(c.expr) != 1024 || !vf.Validate()) {
+            std::cout << c.expr << ": " << vf.GetErrorString() << std::endl;
+            return -2;
+        }
+        vf.SetVariable("y", y);
+
+        // the exact values come from cmath: Eigen's own exp() does not return subnormal numbers
+        VFormula <double> exact;
+        exact.AddVariable("x");
+        exact.AddVariable("y");
+        exact.ParseExpr(c.expr);
+        Eigen::ArrayXd ref(npts);
+        const double *cols[] = {x.data(), y.data()};
+        exact.EvalBatch(cols, npts, ref.data());
+
+        for (auto acc : {VF::Approx12, VF::Approx6}) {
+            vf.SetAccuracy(acc);
+            double bound = acc == VF::Approx12 ? 1e-12 : 1e-6;
+            double maxerr = 0.;
+            for (auto mode : {VF::StackMachine, VF::RegisterMachine}) {
+                vf.SetBackend(mode);
+                Eigen::ArrayXd res = vf.Eval(x);
+                for (int i=0; i<npts; i++)
+                    maxerr = std::max(maxerr, relerr(res[i], ref[i]));
+            }
+
+            bool ok = maxerr < bound;
+            std::cout << c.expr << " \t[" << c.xmin << ", " << c.xmax << (c.logx ? "] (log) " : "] ")
+                      << "max relative error " << maxerr << " \t(bound " << bound << ") "
+                      << (ok ? "OK" : "FAILED") << std::endl;
+            if (!ok)
+                failed++;
+        }
+    }
+    std::cout << (failed ? "Accuracy test FAILED" : "Accuracy test passed") << std::endl;
+    return failed ? 1 : 0;
+}
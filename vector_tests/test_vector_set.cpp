@@ -0,0 +1,76 @@
+#include <Eigen/Dense>
+#include "vformula.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+int main()
+{
+// typical per-event quantities: many of them share sqrt(x^2+y^2) and atan(y/x)
+    std::vector <std::string> exprs;
+    for (int k=0; k<20; k++) {
+        std::string c = std::to_string(k+1) + ".5";
+        switch (k % 4) {
+            case 0: exprs.push_back("sqrt(x^2+y^2)*" + c); break;
+            case 1: exprs.push_back("exp(-sqrt(x^2+y^2)/" + c + ")"); break;
+            case 2: exprs.push_back("sin(atan(y/x)+" + c + ")*sqrt(x^2+y^2)"); break;
+            default: exprs.push_back("(x-" + c + ")^2+(y+" + c + ")^2"); break;
+        }
+    }
+
+    typedef VFormula <Eigen::ArrayXd> VF;
+    VFormulaSet <Eigen::ArrayXd> set;
+    set.AddVariable("x");
+    set.AddVariable("y");
+    if (set.ParseExprs(exprs) != 1024 || !set.Validate()) {
+        std::cout << "Expression " << set.GetFailedExpr() << ": " << set.GetErrorString() << std::endl;
+        return -1;
+    }
+    std::vector <VF> single(exprs.size());
+    for (size_t k=0; k<exprs.size(); k++) {
+        single[k].AddVariable("x");
+        single[k].AddVariable("y");
+        single[k].ParseExpr(exprs[k]);
+    }
+
+    int failed = 0;
+    for (int n : {1000, 100000}) { // the longer vectors are evaluated in tiles
+        Eigen::ArrayXd x = Eigen::ArrayXd::Random(n) + 2.;
+        Eigen::ArrayXd y = Eigen::ArrayXd::Random(n);
+        std::vector <Eigen::ArrayXd> out(exprs.size()), ref(exprs.size());
+        int nrep = 20000000 / n / exprs.size();
+
+        for (auto mode : {VF::StackMachine, VF::RegisterMachine}) {
+            set.SetBackend(mode);
+            VF::Context ctx = set.MakeContext();
+            set.SetVariable(ctx, "y", y);
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i=0; i<nrep; i++)
+                set.EvalAll(ctx, x, out.data());
+            auto end = std::chrono::high_resolution_clock::now();
+            double tset = std::chrono::duration <double, std::milli> (end - start).count();
+
+            start = std::chrono::high_resolution_clock::now();
+            for (int i=0; i<nrep; i++)
+                for (size_t k=0; k<exprs.size(); k++) {
+                    single[k].SetBackend(mode);
+                    single[k].SetVariable("y", y);
+                    ref[k] = single[k].Eval(x);
+                }
+            end = std::chrono::high_resolution_clock::now();
+            double tsingle = std::chrono::duration <double, std::milli> (end - start).count();
+
+            for (size_t k=0; k<exprs.size(); k++)
+                if (!(out[k] == ref[k]).all()) {
+                    std::cout << exprs[k] << ": different results" << std::endl;
+                    failed++;
+                }
+            std::cout << exprs.size() << " formulas, " << n << " points, "
+                      << (mode == VF::StackMachine ? "stack" : "register") << " machine: "
+                      << tsingle/nrep << " ms one by one, " << tset/nrep << " ms as a set" << std::endl;
+        }
+    }
+    std::cout << (failed ? "Formula set test FAILED" : "Formula set test passed") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -31,25 +31,103 @@ int main(int argc, char **argv)
         return -3;
     }
 
-// timed run
-    int vlen = 100;         // vector length, i.e number of evals in one go
-    int nevals = 10000000;  // total number of evals tor run
-    int nreps = nevals/vlen;// number of repetitions
-    double sum =  0.;
-    Eigen::ArrayXd x = Eigen::ArrayXd::Constant(vlen, 0.);
-
-    std::cout << "Timed run: vector of " << vlen << " variables, repeated " << nreps << " times\n";
-    auto start = std::chrono::high_resolution_clock::now();
-
-    //  Code to be timed
-    for (int i=0; i<nreps; i++) {
-        x[0] = i*1e-6;
-        sum += vf.Eval(x)[0];
+// timed run, once for each backend
+    for (auto mode : {VFormula <Eigen::ArrayXd>::StackMachine, VFormula <Eigen::ArrayXd>::RegisterMachine}) {
+        vf.SetBackend(mode);
+        int vlen = 100;         // vector length, i.e number of evals in one go
+        int nevals = 10000000;  // total number of evals tor run
+        int nreps = nevals/vlen;// number of repetitions
+        double sum =  0.;
+        Eigen::ArrayXd x = Eigen::ArrayXd::Constant(vlen, 0.);
+
+        std::cout << "Timed run (" << (mode == VFormula <Eigen::ArrayXd>::StackMachine ? "stack" : "register")
+                  << " machine): vector of " << vlen << " variables, repeated " << nreps << " times\n";
+        auto start = std::chrono::high_resolution_clock::now();
+
+        //  Code to be timed
+        for (int i=0; i<nreps; i++) {
+            x[0] = i*1e-6;
+            sum += vf.Eval(x)[0];
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << sum << std::endl;
+        auto diff = end - start;
+        std::cout << std::chrono::duration <double, std::nano> (diff).count()/nevals << " ns/eval" << std::endl;
     }
 
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << sum << std::endl;
-    auto diff = end - start;
-    std::cout << std::chrono::duration <double, std::nano> (diff).count()/nevals << " ns/eval" << std::endl;
+// long vectors: untiled and tiled evaluation
+    vf.SetBackend(VFormula <Eigen::ArrayXd>::StackMachine);
+    size_t tilesize = vf.GetTileSize();
+    for (size_t tile : {size_t(0), tilesize}) {
+        vf.SetTileSize(tile);
+        int vlen = 4000000;
+        int nreps = 10;
+        Eigen::ArrayXd x = Eigen::ArrayXd::LinSpaced(vlen, -10., 10.);
+        Eigen::ArrayXd y(vlen);
+        VFormula <Eigen::ArrayXd>::Context ctx = vf.MakeContext();
+        vf.EvalInto(ctx, x, y);
+
+        std::cout << "Timed run (" << (tile ? "tiles of " + std::to_string(tile) : std::string("no tiles"))
+                  << "): vector of " << vlen << " variables, repeated " << nreps << " times\n";
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i=0; i<nreps; i++)
+            vf.EvalInto(ctx, x, y);
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << y.sum() << std::endl;
+        auto diff = end - start;
+        std::cout << std::chrono::duration <double, std::nano> (diff).count()/vlen/nreps << " ns/eval" << std::endl;
+    }
+
+// long vectors with the approximate functions
+    for (auto acc : {VFormula <Eigen::ArrayXd>::Exact, VFormula <Eigen::ArrayXd>::Approx12, VFormula <Eigen::ArrayXd>::Approx6}) {
+        vf.SetAccuracy(acc);
+        int vlen = 4000000;
+        int nreps = 10;
+        Eigen::ArrayXd x = Eigen::ArrayXd::LinSpaced(vlen, -10., 10.);
+        Eigen::ArrayXd y(vlen);
+        VFormula <Eigen::ArrayXd>::Context ctx = vf.MakeContext();
+        vf.EvalInto(ctx, x, y);
+
+        std::cout << "Timed run (accuracy " << (acc == VFormula <Eigen::ArrayXd>::Exact ? "exact" :
+                                                acc == VFormula <Eigen::ArrayXd>::Approx12 ? "1e-12" : "1e-6")
+                  << "): vector of " << vlen << " variables, repeated " << nreps << " times\n";
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i=0; i<nreps; i++)
+            vf.EvalInto(ctx, x, y);
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << y.sum() << std::endl;
+        auto diff = end - start;
+        std::cout << std::chrono::duration <double, std::nano> (diff).count()/vlen/nreps << " ns/eval" << std::endl;
+    }
+    vf.SetAccuracy(VFormula <Eigen::ArrayXd>::Exact);
+
+// long vector on a thread pool, compared with the single-threaded result
+    {
+        VThreadPool pool;
+        int vlen = 4000000;
+        int nreps = 10;
+        Eigen::ArrayXd x = Eigen::ArrayXd::LinSpaced(vlen, -10., 10.);
+        Eigen::ArrayXd y(vlen), yref(vlen);
+        VFormula <Eigen::ArrayXd>::Context ctx = vf.MakeContext();
+        vf.EvalInto(ctx, x, yref);
+
+        std::cout << "Timed parallel run (" << pool.GetThreadCount() << " threads): vector of " << vlen
+                  << " variables, repeated " << nreps << " times\n";
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i=0; i<nreps; i++)
+            vf.EvalParallel(pool, x, y);
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << y.sum() << std::endl;
+        auto diff = end - start;
+        std::cout << std::chrono::duration <double, std::nano> (diff).count()/vlen/nreps << " ns/eval" << std::endl;
+        std::cout << "Mismatches: " << (y != yref && !(y.isNaN() && yref.isNaN())).count() << std::endl;
+    }
     return 0;
 }
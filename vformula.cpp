@@ -1,50 +1,65 @@
 #include "vformula.h"
 #include <algorithm>
+#include <array>
+#include <charconv>
+#include <unordered_map>
+#include <functional>
+#include <map>
 #include <iostream>
 #include <cstddef>
 #include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
 
 //#include <chrono>
 
-VParser::VParser()
+// the tables of operations and functions are built once and copied into every new parser
+VParser::VParser() : VParser(Builtins())
 {
-    AddOperation("+", "ADD", 5);
-    AddOperation("-", "SUB", 5);
-    AddOperation("*", "MUL", 4);
-    AddOperation("/", "DIV", 4);
-    AddOperation("^", "POW", 3);
-// unary minus and plus  
-    neg = AddOperation("--", "NEG", 2, 1);
-    nop = AddOperation("++", "NOP", 2, 1);
-    
-    pow2 = AddFunction("pow2", "POW2");
-    pow3 = AddFunction("pow3", "POW3");
-
-    AddFunction("pow", "POW", 2);
-    AddFunction("abs", "ABS");
-    AddFunction("sqrt", "SQRT");
-    AddFunction("exp", "EXP");
-    AddFunction("log", "LOG");
-
-    AddFunction("sin", "SIN");
-    AddFunction("cos", "COS");
-    AddFunction("tan", "TAN");
-    AddFunction("asin", "ASIN");
-    AddFunction("acos", "ACOS");
-    AddFunction("atan", "ATAN");
-
-    AddFunction("sinh", "SINH");
-    AddFunction("cosh", "COSH");
-    AddFunction("tanh", "TANH");
-    AddFunction("asinh", "ASINH");
-    AddFunction("acosh", "ACOSH");
-    AddFunction("atanh", "ATANH");
-
-    AddFunction("max", "MAX", 2);
-    AddFunction("min", "MIN", 2);
+}
 
+const VParser &VParser::Builtins()
+{
+    static const VParser builtins = [] {
+        VParser p{NoBuiltins()};
+        p.opadd = p.AddOperation("+", "ADD", 5);
+        p.opsub = p.AddOperation("-", "SUB", 5);
+        p.opmul = p.AddOperation("*", "MUL", 4);
+        p.opdiv = p.AddOperation("/", "DIV", 4);
+        p.AddOperation("^", "POW", 3);
+// unary minus and plus  
+        p.neg = p.AddOperation("--", "NEG", 2, 1);
+        p.nop = p.AddOperation("++", "NOP", 2, 1);
+        
+        p.pow2 = p.AddFunction("pow2", "POW2");
+        p.pow3 = p.AddFunction("pow3", "POW3");
+
+        p.AddFunction("pow", "POW", 2);
+        p.AddFunction("abs", "ABS");
+        p.AddFunction("sqrt", "SQRT");
+        p.AddFunction("exp", "EXP");
+        p.AddFunction("log", "LOG");
+
+        p.AddFunction("sin", "SIN");
+        p.AddFunction("cos", "COS");
+        p.AddFunction("tan", "TAN");
+        p.AddFunction("asin", "ASIN");
+        p.AddFunction("acos", "ACOS");
+        p.AddFunction("atan", "ATAN");
+
+        p.AddFunction("sinh", "SINH");
+        p.AddFunction("cosh", "COSH");
+        p.AddFunction("tanh", "TANH");
+        p.AddFunction("asinh", "ASINH");
+        p.AddFunction("acosh", "ACOSH");
+        p.AddFunction("atanh", "ATANH");
+
+        p.AddFunction("max", "MAX", 2);
+        p.AddFunction("min", "MIN", 2);
+        return p;
+    }();
+    return builtins;
 }
 
 void VParser::VFail(int pos, std::string msg)
@@ -59,6 +74,7 @@ bool VParser::Validate()
     valid = true;
     size_t codelen = Command.size();
     int stkptr = 0;
+    int maxdepth = 0;
     bool finished = false;
 
     for (size_t i=0; i<codelen; i++) {
@@ -96,7 +112,30 @@ bool VParser::Validate()
                 stkptr--;
                 finished = true;
                 break;                      
+            case CmdAddConst: case CmdSubConst: case CmdMulConst: case CmdDivConst:
+            case CmdRSubConst: case CmdRDivConst:
+                if (addr >= Const.size())
+                    VFail(i, "Constant out of range");
+                break;
+            case CmdAddVar: case CmdSubVar: case CmdMulVar: case CmdDivVar:
+                if (addr >= VarName.size())
+                    VFail(i, "Variable out of range");
+                break;
+            case CmdMulAddConst:
+                if (addr >= Const.size())
+                    VFail(i, "Constant out of range");
+                stkptr--;
+                break;
+            case CmdMulAddVar:
+                if (addr >= VarName.size())
+                    VFail(i, "Variable out of range");
+                stkptr--;
+                break;
+            default:
+                VFail(i, std::string("Unknown command ") + std::to_string(cmd));
         }
+        if (stkptr > maxdepth)
+            maxdepth = stkptr;
         if (finished)
             break;
     }
@@ -104,21 +143,659 @@ bool VParser::Validate()
     if (stkptr != 0)
         VFail(-1, std::string("Stack is out of balance by ") + std::to_string(stkptr) + " position(s)");
 
+    if (valid)
+        StackDepth = maxdepth; // otherwise keep the safe upper bound set by the parser
+
     return valid;
 }
 
 // parses provided expression
 // returns 1024 on success or first error position on failure
 int VParser::ParseExpr(std::string expr)
+{
+    Command.clear();
+    HoistCode.clear();
+    PruneConstants();
+    bool success = AppendExpr(expr);
+// each command pushes at most one element, so this stack size is always sufficient
+// Validate() replaces it with the exact maximum depth
+    StackDepth = Command.size();
+    return success ? 1024 : TokPos;
+}
+
+// parses several expressions into one program: the result of every expression but the last one
+// is written to a hidden variable (_out0, _out1...), whose addresses are returned in outvar,
+// the result of the last one is returned by the program
+// returns 1024 on success or the error position in expression failed
+int VParser::ParseExprs(const std::vector <std::string> &exprs, std::vector <size_t> &outvar, size_t &failed)
+{
+    Command.clear();
+    HoistCode.clear();
+    PruneConstants();
+    outvar.clear();
+    failed = 0;
+    bool success = true;
+    for (size_t k=0; k<exprs.size() && success; k++) {
+        success = AppendExpr(exprs[k]);
+        if (!success)
+            failed = k;
+        else if (k+1 < exprs.size()) { // the write replaces CmdReturn
+            std::string name = "_out" + std::to_string(k);
+            size_t addr, target;
+            if (!FindSymbol(VarName, name, &addr)) {
+                VarName.push_back(name);
+                addr = VarName.size()-1;
+            }
+            Command.back() = MkCmd(CmdWriteVar, addr);
+            outvar.push_back(addr);
+        // the last subexpression is an assignment: it is done as well, for the following expressions
+            if (!TargetVar.empty() && FindSymbol(VarName, TargetVar, &target)) {
+                Command.push_back(MkCmd(CmdReadVar, addr));
+                Command.push_back(MkCmd(CmdWriteVar, target));
+            }
+        }
+    }
+    StackDepth = Command.size();
+    return success ? 1024 : TokPos;
+}
+
+// translates expr and appends its commands to Command, the auto constants are kept
+bool VParser::AppendExpr(const std::string &expr)
 {
     Expr = expr;
     TokPos = 0;
     LastToken = Token(TokNull, "");
-    Command.clear();
+    TargetVar.clear(); // the last subexpression of the previous expression may have been an assignment
     while(!OpStack.empty()) // empty operation stack
         OpStack.pop();
+    return ShuntingYard();
+}
+
+void VParser::GetProgram(VProgram &prg) const
+{
+    prg.Command = Command;
+    prg.HoistCode = HoistCode;
+    prg.AutoConst.assign(Const.begin() + ConstName.size(), Const.end());
+    prg.VarName = VarName.GetNames();
+    prg.RegCode = RegCode;
+    prg.RegCount = RegCount;
+    prg.StackDepth = StackDepth;
+}
+
+void VParser::SetProgram(const VProgram &prg)
+{
+    Command = prg.Command;
+    HoistCode = prg.HoistCode;
     PruneConstants();
-    return ShuntingYard() ? 1024 : TokPos;
+    Const.insert(Const.end(), prg.AutoConst.begin(), prg.AutoConst.end());
+    VarName = prg.VarName;
+    RegCode = prg.RegCode;
+    RegCount = prg.RegCount;
+    StackDepth = prg.StackDepth;
+    valid = true;
+    ErrorString.clear();
+}
+
+// FNV-1a over the names of the constants, declared variables, functions and operations and the
+// properties of the latter; the values of the named constants do not matter, they are not folded.
+// The variables created by parsing (assignment targets, _outK, _cseN) are left out: they depend on
+// the expressions parsed so far, and a cached program brings its own.
+uint64_t VParser::GetFingerprint() const
+{
+    uint64_t h = 14695981039346656037ULL;
+    auto add = [&h](const std::string &s) {
+        for (unsigned char c : s)
+            h = (h ^ c) * 1099511628211ULL;
+        h = (h ^ 0xff) * 1099511628211ULL; // separator, not a character of a name
+    };
+    auto addint = [&add](int i) {add(std::to_string(i));};
+    auto addnames = [&add](const auto &names) {
+        for (const std::string &name : names)
+            add(name);
+        add("");
+    };
+
+    addnames(ConstName);
+    for (size_t slot : DeclaredVar)
+        if (slot < VarName.size()) {
+            add(VarName[slot]);
+            addint(slot);
+        }
+    add("");
+    addnames(FuncName);
+    addnames(FuncMnem);
+    addnames(OperName);
+    addnames(OperMnem);
+    for (auto *ints : {&FuncArgs, &OperRank, &OperArgs})
+        for (int i : *ints)
+            addint(i);
+    return h;
+}
+
+// Moves every largest subexpression built only of constants out of the program: it is replaced with
+// the read of a new nameless constant, and its commands go to HoistCode, from which VFormula computes
+// the constant once and again whenever a named constant it reads is changed. Subexpressions of numbers
+// only are already folded by then, so these read at least one named constant, e.g. 1/(sqrt(2*pi)*sigma).
+// Identical subexpressions share one constant. Works on the plain commands, i.e. before FuseCommands().
+void VParser::HoistInvariants()
+{
+    struct Operand {
+        size_t start;    // position of the first command computing this operand
+        bool invariant;  // computed from constants only
+    };
+    std::vector <Operand> operands;
+    std::vector <Cmdaddr> out;
+    std::vector <std::pair <std::vector <Cmdaddr>, size_t>> hoisted; // commands and constant of each subexpression
+    const size_t nconst = Const.size();
+    bool balanced = true;
+    HoistCode.clear();
+
+// replaces the commands of one operand, out[start, end), with the read of the constant computing it
+    auto hoist = [&](size_t start, size_t end) {
+        if (end - start < 2) // a constant already
+            return;
+        std::vector <Cmdaddr> code(out.begin()+start, out.begin()+end);
+        size_t addr = Const.size();
+        for (const auto &h : hoisted)
+            if (h.first.size() == code.size() && std::equal(code.begin(), code.end(), h.first.begin(),
+                    [](const Cmdaddr &a, const Cmdaddr &b) {return a.cmd == b.cmd && a.addr == b.addr;}))
+                addr = h.second;
+        if (addr == Const.size()) {
+            Const.push_back(0.); // computed by the evaluator
+            HoistCode.insert(HoistCode.end(), code.begin(), code.end());
+            HoistCode.push_back(MkCmd(CmdReturn, addr));
+            hoisted.emplace_back(code, addr);
+        }
+        out.erase(out.begin()+start+1, out.begin()+end);
+        out[start] = MkCmd(CmdReadConst, addr);
+    };
+
+    for (const Cmdaddr &c : Command) {
+        int nargs = -1; // stays negative for the commands which do not combine operands
+        switch (c.cmd) {
+            case CmdReadConst:
+                operands.push_back({out.size(), true});
+                break;
+            case CmdReadVar:
+                operands.push_back({out.size(), false});
+                break;
+            case CmdOper:
+                nargs = OperArgs[c.addr];
+                break;
+            case CmdFunc:
+                nargs = FuncArgs[c.addr];
+                break;
+            case CmdWriteVar:
+            case CmdReturn:
+                balanced = operands.size() == 1;
+                if (balanced && operands.back().invariant)
+                    hoist(operands.back().start, out.size());
+                operands.clear();
+                break;
+        }
+        if (nargs >= 0 && operands.size() < (size_t)nargs)
+            balanced = false;
+        if (!balanced)
+            break;
+        if (nargs >= 0) {
+            size_t first = operands.size()-nargs;
+            bool invariant = nargs > 0; // a function without arguments is not known to return a constant
+            for (size_t k=first; k<operands.size(); k++)
+                invariant = invariant && operands[k].invariant;
+            if (!invariant) // from the last operand, so that the positions of the others stay valid
+                for (size_t k=operands.size(); k-- > first; )
+                    if (operands[k].invariant)
+                        hoist(operands[k].start, k+1 < operands.size() ? operands[k+1].start : out.size());
+            size_t start = nargs > 0 ? operands[first].start : out.size();
+            operands.resize(first);
+            operands.push_back({start, invariant});
+        }
+        out.push_back(c);
+    }
+    if (!balanced) { // not a valid program, Validate() reports it: nothing is hoisted
+        Const.resize(nconst);
+        HoistCode.clear();
+        return;
+    }
+    Command = out;
+}
+
+// Common subexpression elimination. The program is turned into a DAG, in which identical subtrees
+// share one node; a read of a variable is identified by the variable and the number of assignments
+// to it so far, so the subtrees are matched across ';' subexpressions as well. Every non-trivial
+// node used more than once is computed only once into a hidden temporary variable (_cse0, _cse1...)
+// right before the first subexpression using it. Works on the plain commands, i.e. before FuseCommands().
+void VParser::EliminateCommonSubexpr()
+{
+    struct Node {
+        int cmd, addr;
+        int kid[2];     // argument nodes, -1 if none
+        int uses = 0;   // number of references from other nodes and subexpression roots
+        int temp = -1;  // variable holding the value of a shared node
+        bool done = false;
+    };
+    std::vector <Node> nodes;
+    std::map <std::array<int, 5>, int> index; // cmd, addr, variable version, arguments -> node
+    std::vector <int> version(VarName.size(), 0);
+    std::vector <std::pair<int, Cmdaddr>> statements; // root node and the final POPV or RETURN
+    std::vector <int> stack;
+
+    auto node = [&](int cmd, int addr, int ver, int k0, int k1) {
+        std::array<int, 5> key = {cmd, addr, ver, k0, k1};
+        auto it = index.find(key);
+        if (it != index.end())
+            return it->second;
+        Node n;
+        n.cmd = cmd; n.addr = addr; n.kid[0] = k0; n.kid[1] = k1;
+        nodes.push_back(n);
+        index[key] = nodes.size()-1;
+        return (int)nodes.size()-1;
+    };
+
+    for (const Cmdaddr &c : Command) {
+        int k0, k1, nargs;
+        switch (c.cmd) {
+            case CmdReadConst:
+                stack.push_back(node(c.cmd, c.addr, 0, -1, -1));
+                break;
+            case CmdReadVar:
+                stack.push_back(node(c.cmd, c.addr, version[c.addr], -1, -1));
+                break;
+            case CmdOper:
+            case CmdFunc:
+                nargs = c.cmd == CmdOper ? OperArgs[c.addr] : FuncArgs[c.addr];
+                if (stack.size() < (size_t)nargs)
+                    return;
+                k1 = nargs == 2 ? stack.back() : -1;
+                if (nargs == 2)
+                    stack.pop_back();
+                k0 = stack.back();
+                stack.pop_back();
+                stack.push_back(node(c.cmd, c.addr, 0, k0, k1));
+                break;
+            case CmdWriteVar:
+            case CmdReturn:
+                if (stack.size() != 1)
+                    return;
+                statements.push_back(std::make_pair(stack.back(), c));
+                stack.pop_back();
+                if (c.cmd == CmdWriteVar)
+                    version[c.addr]++;
+                break;
+            default: // not a plain program: leave it as it is
+                return;
+        }
+    }
+
+    for (const Node &n : nodes)
+        for (int k : n.kid)
+            if (k >= 0)
+                nodes[k].uses++;
+    for (auto &st : statements)
+        nodes[st.first].uses++;
+
+    int ntemps = 0;
+    for (Node &n : nodes)
+        if (n.uses > 1 && n.kid[0] >= 0) {
+            std::string name = std::string("_cse") + std::to_string(ntemps++);
+            size_t addr;
+            if (!FindSymbol(VarName, name, &addr)) {
+                VarName.push_back(name);
+                addr = VarName.size()-1;
+            }
+            n.temp = addr;
+        }
+    if (ntemps == 0)
+        return;
+
+    std::vector <Cmdaddr> out;
+    // code computing node n, taking the shared nodes already computed from their temporaries
+    std::function<void(int)> code = [&](int n) {
+        if (nodes[n].done) {
+            out.push_back(MkCmd(CmdReadVar, nodes[n].temp));
+            return;
+        }
+        for (int k : nodes[n].kid)
+            if (k >= 0)
+                code(k);
+        out.push_back(MkCmd(nodes[n].cmd, nodes[n].addr));
+    };
+    // computes the shared nodes of the subtree of n not computed yet, arguments first
+    std::function<void(int)> hoist = [&](int n) {
+        if (nodes[n].done || nodes[n].kid[0] < 0)
+            return;
+        for (int k : nodes[n].kid)
+            if (k >= 0)
+                hoist(k);
+        if (nodes[n].temp >= 0) {
+            code(n);
+            out.push_back(MkCmd(CmdWriteVar, nodes[n].temp));
+            nodes[n].done = true;
+        }
+    };
+
+    for (auto &st : statements) {
+        hoist(st.first);
+        code(st.first);
+        out.push_back(st.second);
+    }
+    Command = out;
+}
+
+// replaces frequent command sequences with fused commands:
+//   PUSHC c, ADD/SUB/MUL/DIV  ->  ADDC/SUBC/MULC/DIVC c
+//   PUSHV v, ADD/SUB/MUL/DIV  ->  ADDV/SUBV/MULV/DIVV v
+//   MUL, ADDC c  ->  MADDC c     MUL, ADDV v  ->  MADDV v
+// Before that, a constant or a variable which is the first operand of an arithmetic operation
+// with a more complex second operand E is moved behind E, so that it can be fused as well:
+//   PUSHC/PUSHV p, E, ADD/MUL  ->  E, PUSHC/PUSHV p, ADD/MUL  (IEEE addition and multiplication commute)
+//   PUSHC c, E, SUB/DIV  ->  E, RSUBC/RDIVC c
+void VParser::FuseCommands()
+{
+    std::vector <Cmdaddr> out;
+    std::vector <size_t> starts; // positions in out where the operands on the stack begin
+    for (const Cmdaddr &c : Command) {
+        int nargs = 0;
+        switch (c.cmd) {
+            case CmdReadConst:
+            case CmdReadVar:
+                starts.push_back(out.size());
+                break;
+            case CmdOper:
+                nargs = OperArgs[c.addr];
+                break;
+            case CmdFunc:
+                nargs = FuncArgs[c.addr];
+                break;
+            default:
+                starts.clear();
+        }
+        if (nargs == 0 || starts.size() < (size_t)nargs) {
+            out.push_back(c);
+            continue;
+        }
+        size_t first = starts[starts.size()-nargs];
+        size_t second = starts.back();
+        starts.resize(starts.size()-nargs);
+        starts.push_back(first);
+
+        bool arith = c.cmd == CmdOper && (c.addr == opadd || c.addr == opsub || c.addr == opmul || c.addr == opdiv);
+        if (arith && nargs == 2 && second == first + 1 && out.size() - second > 1) {
+            Cmdaddr p = out[first];
+            bool push = p.cmd == CmdReadConst || p.cmd == CmdReadVar;
+            bool commutes = c.addr == opadd || c.addr == opmul;
+            if (push && (commutes || p.cmd == CmdReadConst)) {
+                out.erase(out.begin() + first);
+                if (commutes) {
+                    out.push_back(p);
+                    out.push_back(c);
+                } else
+                    out.push_back(MkCmd(c.addr == opsub ? CmdRSubConst : CmdRDivConst, p.addr));
+                continue;
+            }
+        }
+        out.push_back(c);
+    }
+    Command = out;
+
+    out.clear();
+    for (const Cmdaddr &c : Command) {
+        if (c.cmd == CmdOper && !out.empty()) {
+            Cmdaddr &prev = out.back();
+            int fused = CmdNop;
+            if (prev.cmd == CmdReadConst || prev.cmd == CmdReadVar) {
+                int base = prev.cmd == CmdReadConst ? CmdAddConst : CmdAddVar;
+                if (c.addr == opadd)
+                    fused = base;
+                else if (c.addr == opsub)
+                    fused = base + 1;
+                else if (c.addr == opmul)
+                    fused = base + 2;
+                else if (c.addr == opdiv)
+                    fused = base + 3;
+            }
+            if (fused != CmdNop) {
+                prev.cmd = fused;
+                // the multiplication right before can be merged with the addition
+                if ((fused == CmdAddConst || fused == CmdAddVar) && out.size() > 1) {
+                    Cmdaddr &mul = out[out.size()-2];
+                    if (mul.cmd == CmdOper && mul.addr == opmul) {
+                        mul = MkCmd(fused == CmdAddConst ? CmdMulAddConst : CmdMulAddVar, prev.addr);
+                        out.pop_back();
+                    }
+                }
+                continue;
+            }
+        }
+        out.push_back(c);
+    }
+    Command = out;
+}
+
+// derivative rule of the built-in operations and functions by their mnemonics
+VParser::GradRule VParser::FindGradRule(const std::string &mnem)
+{
+    static const std::unordered_map <std::string, GradRule> rules = {
+        {"ADD", GradAdd}, {"SUB", GradSub}, {"MUL", GradMul}, {"DIV", GradDiv}, {"POW", GradPow},
+        {"NEG", GradNeg}, {"NOP", GradNop}, {"POW2", GradPow2}, {"POW3", GradPow3},
+        {"ABS", GradAbs}, {"SQRT", GradSqrt}, {"EXP", GradExp}, {"LOG", GradLog},
+        {"SIN", GradSin}, {"COS", GradCos}, {"TAN", GradTan},
+        {"ASIN", GradAsin}, {"ACOS", GradAcos}, {"ATAN", GradAtan},
+        {"SINH", GradSinh}, {"COSH", GradCosh}, {"TANH", GradTanh},
+        {"ASINH", GradAsinh}, {"ACOSH", GradAcosh}, {"ATANH", GradAtanh},
+        {"MAX", GradMax}, {"MIN", GradMin}
+    };
+    auto itr = rules.find(mnem);
+    return itr == rules.end() ? GradNumeric : itr->second;
+}
+
+// translates the stack program in Command into the single-assignment form for EvalGrad()
+// the stack is simulated at compile time: each stack element is the number of a value, and
+// each variable refers to the value last written to it or to its value at the start
+void VParser::CompileGradient()
+{
+    std::vector <unsigned> stack;
+    std::vector <long> varvalue(VarName.size(), -1);
+    GradCode.clear();
+    GradResult = 0;
+
+    auto emit = [this](int cmd, int addr, unsigned short rule, unsigned a, unsigned b) {
+        GradCmd gc;
+        gc.cmd = cmd; gc.addr = addr; gc.rule = rule; gc.a = a; gc.b = b;
+        GradCode.push_back(gc);
+        return unsigned(GradCode.size()-1);
+    };
+    // the constants computed from HoistCode are expanded into their commands, so that the
+    // derivatives with respect to the named constants they read are kept
+    std::vector <long> hoiststart(Const.size(), -1), hoistvalue(Const.size(), -1);
+    for (size_t i=0, start=0; i<HoistCode.size(); i++)
+        if (HoistCode[i].cmd == CmdReturn) {
+            if (HoistCode[i].addr < Const.size())
+                hoiststart[HoistCode[i].addr] = start;
+            start = i+1;
+        }
+    auto constant = [&](size_t addr) {
+        if (addr >= hoiststart.size() || hoiststart[addr] < 0)
+            return emit(CmdReadConst, addr, GradNumeric, 0, 0);
+        if (hoistvalue[addr] < 0) {
+            std::vector <unsigned> sub;
+            for (size_t i=hoiststart[addr]; HoistCode[i].cmd != CmdReturn; i++) {
+                const Cmdaddr &c = HoistCode[i];
+                if (c.cmd == CmdReadConst) {
+                    sub.push_back(emit(CmdReadConst, c.addr, GradNumeric, 0, 0));
+                    continue;
+                }
+                size_t nargs = c.cmd == CmdOper ? OperArgs[c.addr] : FuncArgs[c.addr];
+                unsigned b = sub.back(), a = nargs > 1 ? sub[sub.size()-2] : b;
+                sub.resize(sub.size() - nargs);
+                sub.push_back(emit(c.cmd, c.addr, c.cmd == CmdOper ? OperGrad[c.addr] : FuncGrad[c.addr], a, b));
+            }
+            hoistvalue[addr] = sub.back();
+        }
+        return unsigned(hoistvalue[addr]);
+    };
+    auto variable = [&](size_t addr) {
+        if (varvalue[addr] < 0)
+            varvalue[addr] = emit(CmdReadVar, addr, GradNumeric, 0, 0);
+        return unsigned(varvalue[addr]);
+    };
+    auto oper = [&](size_t op, unsigned a, unsigned b) {return emit(CmdOper, op, OperGrad[op], a, b);};
+
+    for (const Cmdaddr &c : Command) {
+        size_t nargs = c.cmd == CmdOper ? OperArgs[c.addr] :
+                       c.cmd == CmdFunc ? FuncArgs[c.addr] :
+                       c.cmd == CmdMulAddConst || c.cmd == CmdMulAddVar ? 2 :
+                       c.cmd == CmdReadConst || c.cmd == CmdReadVar ? 0 : 1;
+        if (stack.size() < nargs)
+            break; // not a valid program
+        unsigned a = 0, b = 0;
+        if (nargs > 0) {
+            b = stack.back();
+            stack.pop_back();
+            a = b;
+        }
+        if (nargs > 1) {
+            a = stack.back();
+            stack.pop_back();
+        }
+        switch (c.cmd) {
+            case CmdOper:
+                stack.push_back(oper(c.addr, a, b));
+                break;
+            case CmdFunc:
+                stack.push_back(emit(CmdFunc, c.addr, FuncGrad[c.addr], a, b));
+                break;
+            case CmdReadConst:
+                stack.push_back(constant(c.addr));
+                break;
+            case CmdReadVar:
+                stack.push_back(variable(c.addr));
+                break;
+            case CmdWriteVar:
+                varvalue[c.addr] = a;
+                break;
+            case CmdReturn:
+                GradResult = a;
+                return;
+            case CmdAddConst: case CmdSubConst: case CmdMulConst: case CmdDivConst: {
+                size_t ops[] = {opadd, opsub, opmul, opdiv};
+                stack.push_back(oper(ops[c.cmd - CmdAddConst], a, constant(c.addr)));
+                break;
+            }
+            case CmdAddVar: case CmdSubVar: case CmdMulVar: case CmdDivVar: {
+                size_t ops[] = {opadd, opsub, opmul, opdiv};
+                stack.push_back(oper(ops[c.cmd - CmdAddVar], a, variable(c.addr)));
+                break;
+            }
+            case CmdMulAddConst:
+                stack.push_back(oper(opadd, oper(opmul, a, b), constant(c.addr)));
+                break;
+            case CmdMulAddVar:
+                stack.push_back(oper(opadd, oper(opmul, a, b), variable(c.addr)));
+                break;
+            case CmdRSubConst:
+                stack.push_back(oper(opsub, constant(c.addr), a));
+                break;
+            case CmdRDivConst:
+                stack.push_back(oper(opdiv, constant(c.addr), a));
+                break;
+        }
+    }
+    GradCode.clear(); // no CmdReturn: not a valid program
+}
+
+// translates the stack program in Command into three-address code for the register machine
+// the stack is simulated at compile time: each stack element becomes a register
+void VParser::CompileRegisters()
+{
+    const unsigned short nvar = VarName.size();
+    std::vector <unsigned short> stack;  // registers holding the stack elements
+    std::vector <unsigned short> free;   // temporaries not holding a stack element
+    RegCode.clear();
+    RegCount = nvar;
+
+    auto istemp = [nvar](unsigned short reg) {return reg >= nvar;};
+    auto newtemp = [&]() -> unsigned short {
+        if (free.empty())
+            return RegCount++;
+        unsigned short reg = free.back();
+        free.pop_back();
+        return reg;
+    };
+    // result register of a command reading a and b: reuse one of the temporaries if possible
+    auto result = [&](unsigned short a, unsigned short b) -> unsigned short {
+        if (istemp(a)) {
+            if (istemp(b) && b != a)
+                free.push_back(b);
+            return a;
+        }
+        return istemp(b) ? b : newtemp();
+    };
+    auto pop = [&stack]() {unsigned short reg = stack.back(); stack.pop_back(); return reg;};
+    auto emit = [this](int cmd, int addr, unsigned short dst, unsigned short a, unsigned short b) {
+        RegCmd rc;
+        rc.cmd = cmd; rc.addr = addr; rc.dst = dst; rc.a = a; rc.b = b;
+        RegCode.push_back(rc);
+        return dst;
+    };
+
+    for (const Cmdaddr &c : Command) {
+        size_t nargs = c.cmd == CmdOper ? OperArgs[c.addr] :
+                       c.cmd == CmdFunc ? FuncArgs[c.addr] :
+                       c.cmd == CmdMulAddConst || c.cmd == CmdMulAddVar ? 2 :
+                       c.cmd == CmdReadConst || c.cmd == CmdReadVar ? 0 : 1;
+        if (stack.size() < nargs)
+            break; // not a valid program, Validate() reports it
+        unsigned short a, b;
+        switch (c.cmd) {
+            case CmdOper:
+            case CmdFunc: {
+                b = pop();
+                a = nargs == 2 ? pop() : b;
+                stack.push_back(emit(c.cmd, c.addr, result(a, b), a, b));
+                break;
+            }
+            case CmdReadConst:
+                stack.push_back(emit(CmdReadConst, c.addr, newtemp(), 0, 0));
+                break;
+            case CmdReadVar: // variables are used directly, no copy is needed
+                stack.push_back(c.addr);
+                break;
+            case CmdWriteVar:
+                a = pop();
+                // retarget the command which computed the value if it went into a temporary
+                if (istemp(a) && !RegCode.empty() && RegCode.back().dst == a) {
+                    RegCode.back().dst = c.addr;
+                    free.push_back(a);
+                } else
+                    emit(CmdWriteVar, 0, c.addr, a, a);
+                break;
+            case CmdReturn:
+                a = pop();
+                emit(CmdReturn, 0, 0, a, a);
+                return;
+            case CmdAddConst: case CmdSubConst: case CmdMulConst: case CmdDivConst:
+            case CmdRSubConst: case CmdRDivConst:
+                a = pop();
+                stack.push_back(emit(c.cmd, c.addr, result(a, a), a, a));
+                break;
+            case CmdAddVar: case CmdSubVar: case CmdMulVar: case CmdDivVar: {
+                // variable operand is just another register
+                size_t ops[] = {opadd, opsub, opmul, opdiv};
+                a = pop();
+                stack.push_back(emit(CmdOper, ops[c.cmd - CmdAddVar], result(a, a), a, c.addr));
+                break;
+            }
+            case CmdMulAddConst:
+            case CmdMulAddVar:
+                b = pop();
+                a = pop();
+                stack.push_back(emit(c.cmd, c.addr, result(a, b), a, b));
+                break;
+        }
+    }
+    RegCode.clear(); // no CmdReturn: not a valid program
+    RegCount = nvar;
 }
 
 std::vector<std::string> VParser::GetPrg()
@@ -151,6 +828,20 @@ std::vector<std::string> VParser::GetPrg()
         else if (c == CmdWriteVar)
             //std::cout << buf << "\tPOPV\t" << VarName[i] << std::endl;
             out.push_back(std::string(buf) + "\tPOPV\t" + VarName[i]);
+        else if (c >= CmdAddConst && c <= CmdDivVar) {
+            const char *mnem[] = {"ADDC", "SUBC", "MULC", "DIVC", "ADDV", "SUBV", "MULV", "DIVV"};
+            std::string arg = c >= CmdAddVar ? VarName[i] : (size_t)i < ConstName.size() ?
+                              ConstName[i] + "=" + std::to_string(Const[i]) : std::to_string(Const[i]);
+            out.push_back(std::string(buf) + "\t" + mnem[c - CmdAddConst] + "\t" + arg);
+        }
+        else if (c == CmdMulAddConst)
+            out.push_back(std::string(buf) + "\tMADDC\t" + ((size_t)i < ConstName.size() ?
+                          ConstName[i] + "=" + std::to_string(Const[i]) : std::to_string(Const[i])));
+        else if (c == CmdMulAddVar)
+            out.push_back(std::string(buf) + "\tMADDV\t" + VarName[i]);
+        else if (c == CmdRSubConst || c == CmdRDivConst)
+            out.push_back(std::string(buf) + (c == CmdRSubConst ? "\tRSUBC\t" : "\tRDIVC\t") + ((size_t)i < ConstName.size() ?
+                          ConstName[i] + "=" + std::to_string(Const[i]) : std::to_string(Const[i])));
     }
     return out;
 }
@@ -194,16 +885,19 @@ std::vector<std::string> VParser::GetFuncMap()
     return out;
 }
 
+// Tokens are views into Expr, nothing is copied. On an error the message goes to ErrorString.
 VParser::Token VParser::GetNextToken()
 {
+    const std::string_view expr(Expr);
+
 // skip spaces    
-    while (TokPos < Expr.size() && Expr[TokPos] == ' ')
+    while (TokPos < expr.size() && expr[TokPos] == ' ')
         TokPos++;
 
-    if (TokPos >= Expr.size())
+    if (TokPos >= expr.size())
         return Token(TokEnd, "");
 
-    int ch0 = Expr[TokPos]; // fetch the character at the current token position
+    int ch0 = expr[TokPos]; // fetch the character at the current token position
 
 // parentheses, comma and semicolon
     if (ch0 == '(') {
@@ -223,41 +917,55 @@ VParser::Token VParser::GetNextToken()
         return Token(TokEndSub, ";");
     }
 
-// number
+// number, parsed in place; hexadecimal numbers (0x...) are accepted as by std::stod()
     if (std::isdigit(ch0)) { 
-        std::size_t len;
-        double val = std::stod(Expr.substr(TokPos, std::string::npos), &len);
+        const char *first = expr.data() + TokPos;
+        const char *last = expr.data() + expr.size();
+        double val;
+        std::from_chars_result res;
+        if (ch0 == '0' && last - first > 2 && (first[1] == 'x' || first[1] == 'X') && std::isxdigit(first[2]))
+            res = std::from_chars(first+2, last, val, std::chars_format::hex);
+        else
+            res = std::from_chars(first, last, val);
+        if (res.ec != std::errc()) {
+            ErrorString = "Number out of range";
+            return Token(TokError, "");
+        }
+        size_t len = res.ptr - first;
         int addr = AddAutoConstant(val); // numbers are stored as nameless constants 
         TokPos += len;
-        return Token(TokNumber, Expr.substr(TokPos-len, len), addr); 
+        return Token(TokNumber, expr.substr(TokPos-len, len), addr); 
     }
 
 // symbol (variable, constant or function name)
     if (std::isalpha(ch0)) { 
         size_t len = 1;
-        for (size_t i=TokPos+1; i<Expr.size(); i++) {
-            int ch = Expr[i];
+        for (size_t i=TokPos+1; i<expr.size(); i++) {
+            int ch = expr[i];
             if (!isalpha(ch) && !isdigit(ch) && ch!='_') 
                 break;
             len++;
         }
-        std::string symbol = Expr.substr(TokPos, len);
+        std::string_view symbol = expr.substr(TokPos, len);
         TokPos += len;
     
     // check if it's assignment
-        if (Expr[TokPos] == '=') {
+        if (TokPos < expr.size() && expr[TokPos] == '=') {
             size_t addr;
-            if (FindSymbol(ConstName, symbol, &addr))
-                return Token(TokError, std::string("Can not assign to constant: ")+symbol);
-            if (FindSymbol(ConstName, symbol, &addr))
-                return Token(TokError, std::string("Can not assign to function: ")+symbol);
+            if (FindSymbol(ConstName, symbol, &addr)) {
+                ErrorString = std::string("Can not assign to constant: ") + std::string(symbol);
+                return Token(TokError, symbol);
+            }
+            if (FindSymbol(FuncName, symbol, &addr)) {
+                ErrorString = std::string("Can not assign to function: ") + std::string(symbol);
+                return Token(TokError, symbol);
+            }
 
             if (!FindSymbol(VarName, symbol, &addr)) {
-                VarName.push_back(symbol);
+                VarName.push_back(std::string(symbol));
                 addr = VarName.size()-1;
             } 
             TokPos += 1;
-//            std::cout << "symbol " << symbol << ", size " << VarName.size() << ", addr " << addr << std::endl;
             return Token(TokWrVar, symbol, addr);
         }
 
@@ -270,34 +978,38 @@ VParser::Token VParser::GetNextToken()
             return Token(TokVar, symbol, addr);
 
         if (FindSymbol(FuncName, symbol, &addr)) {
-            if (Expr[TokPos] != '(') {
+            if (TokPos >= expr.size() || expr[TokPos] != '(') {
                 TokPos -= len;
-                return Token(TokError, std::string("Known function ")+symbol+" without ()");
+                ErrorString = std::string("Known function ") + std::string(symbol) + " without ()";
+                return Token(TokError, symbol);
             }
             return Token(TokFunc, symbol, addr);
         }
 
         TokPos -= len;
-        return Token(TokError, std::string("Unknown symbol: ")+symbol);
+        ErrorString = std::string("Unknown symbol: ") + std::string(symbol);
+        return Token(TokError, symbol);
     }
 
 // unary minus and plus
     if (ch0 == '-' || ch0 == '+') {
         TokenType t = LastToken.type;
-        if ( t == TokNull || t == TokOpen || t == TokOper || t==TokComma) {
+        if ( t == TokNull || t == TokOpen || t == TokOper || t==TokComma || t == TokEndSub || t == TokWrVar) {
             TokPos++;
             return Token(TokUnary, ch0 == '-' ? "-" : "+", ch0 == '-' ? neg : nop);
         }
     }    
 
 // operators
+    const std::string_view rest = expr.substr(TokPos);
     for (size_t i=0; i<OperName.size(); i++) 
-        if (Expr.substr(TokPos, std::string::npos).find(OperName[i]) == 0) {
+        if (rest.compare(0, OperName[i].size(), OperName[i]) == 0) {
             TokPos += OperName[i].size();
-            return Token(TokOper, OperName[i], i);
+            return Token(TokOper, rest.substr(0, OperName[i].size()), i);
         }
 
-    return Token(TokError, "Unknown character or character combination");
+    ErrorString = "Unknown character or character combination";
+    return Token(TokError, "");
 }
 
 bool VParser::ShuntingYard()
@@ -312,10 +1024,8 @@ bool VParser::ShuntingYard()
             return false;
         }
 
-        if (token.type == TokError) {
-            ErrorString = token.string;
+        if (token.type == TokError) // ErrorString is set by GetNextToken()
             return false;
-        } 
 
         if (token.type == TokNumber || token.type == TokConst) {
         // we have special treatment for the cases of ^2 and ^3
@@ -336,7 +1046,7 @@ bool VParser::ShuntingYard()
 
         else if (token.type == TokWrVar) {
             if (TargetVar.empty())
-                TargetVar = token.string;
+                TargetVar = std::string(token.string);
             else {
                 ErrorString = std::string("Assignment to '") + TargetVar + "' was not terminated with ';'";
                 return false;
@@ -468,9 +1178,9 @@ bool VParser::CheckSyntax(Token token)
     return true;
 }
 
-bool VParser::FindSymbol(std::vector <std::string> &namevec, std::string symbol, size_t *addr)
+bool VParser::FindSymbol(const std::vector <std::string> &namevec, std::string_view symbol, size_t *addr) const
 {
-    std::vector <std::string> :: iterator itr;
+    std::vector <std::string> :: const_iterator itr;
 
     itr = std::find(namevec.begin(), namevec.end(), symbol);
     if (itr == namevec.end()) 
@@ -486,6 +1196,7 @@ size_t VParser::AddOperation(std::string name, std::string mnem, int rank, int a
     OperMnem.push_back(mnem);
     OperRank.push_back(rank);
     OperArgs.push_back(args);
+    OperGrad.push_back(FindGradRule(mnem));
     return OperName.size()-1;
 }
 
@@ -494,6 +1205,7 @@ size_t VParser::AddFunction(std::string name, std::string mnem, int args)
     FuncName.push_back(name);
     FuncMnem.push_back(mnem);
     FuncArgs.push_back(args);
+    FuncGrad.push_back(FindGradRule(mnem));
     return FuncName.size()-1;
 }
 
@@ -525,8 +1237,9 @@ bool VParser::AddConstant(std::string name, double val)
 
 size_t VParser::AddAutoConstant(double val)
 {
-
-    std::vector <double> :: iterator itr = std::find(Const.begin() + ConstName.size(), Const.end(), val);
+// compared bit by bit, so that -0 and +0 stay apart (1/-0 is -inf) and NaN matches NaN
+    std::vector <double> :: iterator itr = std::find_if(Const.begin() + ConstName.size(), Const.end(),
+        [val](double c) {return std::memcmp(&c, &val, sizeof val) == 0;});
     if (itr != Const.end()) // if an auto constant with the same value already exists
         return itr-Const.begin(); // use it
 
@@ -541,6 +1254,16 @@ void VParser::PruneConstants()
     Const.resize(ConstName.size());
 }
 
+// remove the auto constants no longer used by the program and renumber the rest
+void VParser::CompactConstants()
+{
+    std::vector <double> autoconst(Const.begin() + ConstName.size(), Const.end());
+    PruneConstants();
+    for (auto &cmd : Command)
+        if (cmd.cmd == CmdReadConst && cmd.addr >= ConstName.size())
+            cmd.addr = AddAutoConstant(autoconst[cmd.addr - ConstName.size()]);
+}
+
 bool VParser::AddVariable(std::string name) 
 {
     size_t addr;
@@ -554,8 +1277,12 @@ bool VParser::AddVariable(std::string name)
     }
 
 // add if it's not there already 
-    if (!FindSymbol(VarName, name, &addr))
+    if (!FindSymbol(VarName, name, &addr)) {
         VarName.push_back(name);
+        addr = VarName.size()-1;
+    }
+    if (std::find(DeclaredVar.begin(), DeclaredVar.end(), addr) == DeclaredVar.end())
+        DeclaredVar.push_back(addr);
 
     return true;
 }
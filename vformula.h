@@ -2,13 +2,95 @@
 #define VFORMULA_H
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <typeinfo>
 #include <stack>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <cmath>
 #include <iostream>
 #include <type_traits>
 #include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include "vjit.h"
+#include "vpool.h"
+#include "vcache.h"
+#include "vbundle.h"
+#include "vsimd.h"
+#include "vapprox.h"
+
+// GCC and clang support labels as values: the stack machine then runs a pre-decoded direct-threaded
+// program instead of the switch, define VFORMULA_NO_THREADED_CODE to use the switch anyway
+#if defined(__GNUC__) && !defined(VFORMULA_NO_THREADED_CODE)
+#define VFORMULA_THREADED_CODE
+#endif
+
+// Names of constants, variables or functions: a vector of strings with a hash index for the lookups
+// by name. Only the parts of the vector interface which the parser needs are provided, so the index
+// always follows the contents.
+class VSymbolTable
+{
+public:
+    size_t size() const {return Names.size();}
+    bool empty() const {return Names.empty();}
+    const std::string &operator[](size_t i) const {return Names[i];}
+    std::vector <std::string>::const_iterator begin() const {return Names.begin();}
+    std::vector <std::string>::const_iterator end() const {return Names.end();}
+    const std::vector <std::string> &GetNames() const {return Names;}
+
+    void push_back(const std::string &name)
+    {
+        Index.emplace(std::hash <std::string_view>()(name), Names.size());
+        Names.push_back(name);
+    }
+
+// removes the names from position n on
+    void resize(size_t n)
+    {
+        for (size_t i=n; i<Names.size(); i++) {
+            auto range = Index.equal_range(std::hash <std::string_view>()(Names[i]));
+            for (auto itr = range.first; itr != range.second; ++itr)
+                if (itr->second == i) {
+                    Index.erase(itr);
+                    break;
+                }
+        }
+        if (n < Names.size())
+            Names.resize(n);
+    }
+
+    VSymbolTable &operator=(const std::vector <std::string> &names)
+    {
+        Names.clear();
+        Index.clear();
+        for (const std::string &name : names)
+            push_back(name);
+        return *this;
+    }
+
+// position of the first occurrence of the name
+    bool Find(std::string_view name, size_t *addr) const
+    {
+        size_t first = Names.size();
+        auto range = Index.equal_range(std::hash <std::string_view>()(name));
+        for (auto itr = range.first; itr != range.second; ++itr)
+            if (itr->second < first && Names[itr->second] == name)
+                first = itr->second;
+        if (first == Names.size())
+            return false;
+        *addr = first;
+        return true;
+    }
+
+private:
+    std::vector <std::string> Names;
+    std::unordered_multimap <size_t, size_t> Index; // hash of the name -> position in Names
+};
 
 class VParser
 {
@@ -25,6 +107,17 @@ Possible values of CmdType and associated actions:
 4  CmdReadVar: push variable @addr to the stack
 5  CmdWriteVar: take element from the stack, store it into variable @addr
 6  CmdReturn: stop execution, return top of the stack
+
+Fused commands generated by FuseCommands() from the frequent sequences of the above:
+7  CmdAddConst: add constant @addr to the top element of the stack (PUSHC, ADD)
+8  CmdSubConst: subtract constant @addr from the top element (PUSHC, SUB)
+9  CmdMulConst: multiply the top element by constant @addr (PUSHC, MUL)
+10 CmdDivConst: divide the top element by constant @addr (PUSHC, DIV)
+11-14 CmdAddVar, CmdSubVar, CmdMulVar, CmdDivVar: same with variable @addr (PUSHV, ADD etc.)
+15 CmdMulAddConst: take two top elements, push their product plus constant @addr (MUL, PUSHC, ADD)
+16 CmdMulAddVar: take two top elements, push their product plus variable @addr (MUL, PUSHV, ADD)
+17 CmdRSubConst: replace the top element with constant @addr minus it (PUSHC, ..., SUB)
+18 CmdRDivConst: replace the top element with constant @addr divided by it (PUSHC, ..., DIV)
 */
     enum CmdType {
         CmdNop = 0,
@@ -33,7 +126,19 @@ Possible values of CmdType and associated actions:
         CmdReadConst,
         CmdReadVar,
         CmdWriteVar,
-        CmdReturn
+        CmdReturn,
+        CmdAddConst,
+        CmdSubConst,
+        CmdMulConst,
+        CmdDivConst,
+        CmdAddVar,
+        CmdSubVar,
+        CmdMulVar,
+        CmdDivVar,
+        CmdMulAddConst,
+        CmdMulAddVar,
+        CmdRSubConst,
+        CmdRDivConst
     };
 
     enum TokenType {
@@ -53,12 +158,13 @@ Possible values of CmdType and associated actions:
         TokError
     };
     
+// the text of a token is a view into the parsed expression, which it must not outlive
     struct Token {
         TokenType type;
-        std::string string;
+        std::string_view string;
         int addr;
         int args;
-        Token(TokenType t, std::string s, int a=0) : type(t), string(s), addr(a) {;}
+        Token(TokenType t, std::string_view s, int a=0) : type(t), string(s), addr(a) {;}
     };
     
     struct Cmdaddr{
@@ -67,27 +173,84 @@ Possible values of CmdType and associated actions:
         Cmdaddr(int c, int a) : cmd(c), addr(a) {;} 
     }; 
 
+/*
+Alternative three-address form of the program for the register machine, built by CompileRegisters().
+Registers 0..VarName.size()-1 are the variables, the rest are temporaries.
+Commands reuse CmdType:
+  CmdOper, CmdFunc: r[dst] = operation/function @addr of r[a] (and r[b])
+  CmdReadConst: r[dst] = constant @addr
+  CmdWriteVar: r[dst] = r[a]
+  CmdAddConst...CmdDivConst: r[dst] = r[a] (+-*\/) constant @addr
+  CmdRSubConst, CmdRDivConst: r[dst] = constant @addr (-/) r[a]
+  CmdMulAddConst: r[dst] = r[a] * r[b] + constant @addr
+  CmdMulAddVar: r[dst] = r[a] * r[b] + r[addr]
+  CmdReturn: return r[a]
+*/
+    struct RegCmd {
+        unsigned short cmd;
+        unsigned short addr;
+        unsigned short dst, a, b;
+    };
+
+/*
+Single-assignment form of the program for the gradient evaluator, built by CompileGradient().
+Every command computes a new value, numbered by its position in GradCode, and no value is
+overwritten, so that the backward pass of EvalGrad() can use all of them. Commands reuse CmdType:
+  CmdReadConst, CmdReadVar: value of constant/variable @addr
+  CmdOper, CmdFunc: operation/function @addr of values a and b (b = a for one argument)
+The fused commands are split back into their operations; rule tells how to differentiate them.
+*/
+    enum GradRule {
+        GradNumeric = 0, // unknown kernel: central difference
+        GradAdd, GradSub, GradMul, GradDiv, GradPow, GradNeg, GradNop, GradPow2, GradPow3,
+        GradAbs, GradSqrt, GradExp, GradLog,
+        GradSin, GradCos, GradTan, GradAsin, GradAcos, GradAtan,
+        GradSinh, GradCosh, GradTanh, GradAsinh, GradAcosh, GradAtanh,
+        GradMax, GradMin
+    };
+
+    struct GradCmd {
+        unsigned short cmd;
+        unsigned short addr;
+        unsigned short rule;
+        unsigned a, b;
+    };
+
+/*
+Subexpressions of constants only, moved out of the program by HoistInvariants(): plain commands in postfix
+order, each subexpression ending with CmdReturn @addr, where addr is the nameless constant receiving its value.
+*/
 // Evaluator memory
     std::vector <Cmdaddr> Command; // expression translated to commands in postfix order
+    std::vector <Cmdaddr> HoistCode; // subexpressions computed into constants, see above
     std::vector <double> Const;  // vector of constants
+    size_t StackDepth = 0;       // stack size needed to run the program: exact after Validate(), upper bound before
+    std::vector <RegCmd> RegCode;  // the program for the register machine
+    size_t RegCount = 0;           // number of registers (variables + temporaries) used by RegCode
+    std::vector <GradCmd> GradCode; // the program for the gradient evaluator, empty if not available
+    size_t GradResult = 0;          // value of GradCode returned by the program
 
 // Parser memory
-    std::vector <std::string> ConstName; // names of constants: position corresponds to position in Const
-    std::vector <std::string> VarName;   // names of variables: position corresponds to position in Var
-    std::vector <std::string> FuncName;  // names of functions: position corresponds to position in Func
+    VSymbolTable ConstName; // names of constants: position corresponds to position in Const
+    VSymbolTable VarName;   // names of variables: position corresponds to position in Var
+    std::vector <size_t> DeclaredVar; // positions in VarName of the variables added with AddVariable()
+    VSymbolTable FuncName;  // names of functions: position corresponds to position in Func
     std::vector <std::string> FuncMnem;  // function mnemonics: position corresponds to position in Func
     std::vector <int> FuncArgs; // number of arguments to take, position corresponds to position in Func
     std::vector <std::string> OperName;  // names of operations: position corresponds to position in Oper
     std::vector <std::string> OperMnem;  // operation mnemonics: position corresponds to position in Oper
     std::vector <int> OperRank;  // operation priorities (less is higher): position corresponds to position in Oper
     std::vector <int> OperArgs;  // number of arguments to take, position corresponds to position in Oper
+    std::vector <GradRule> FuncGrad;  // derivative rules of the functions
+    std::vector <GradRule> OperGrad;  // derivative rules of the operations
     std::stack <Token> OpStack;  // parser stack
     std::string TargetVar;       // variable to which the result will be assigned
 
     VParser();
 //    ~VParser() {;}
 
-    bool FindSymbol(std::vector <std::string> &namevec, std::string symbol, size_t *addr);
+    bool FindSymbol(const std::vector <std::string> &namevec, std::string_view symbol, size_t *addr) const;
+    bool FindSymbol(const VSymbolTable &names, std::string_view symbol, size_t *addr) const {return names.Find(symbol, addr);}
 
     size_t AddOperation(std::string name, std::string mnem, int rank, int args=2);
     size_t AddFunction(std::string name, std::string mnem, int args=1);
@@ -101,9 +264,16 @@ Possible values of CmdType and associated actions:
     bool SetConstant(size_t addr, double val);
 
     int ParseExpr(std::string expr);
+    int ParseExprs(const std::vector <std::string> &exprs, std::vector <size_t> &outvar, size_t &failed);
     bool CheckSyntax(Token token);
     Token GetNextToken();
     bool ShuntingYard();
+    void HoistInvariants();
+    void EliminateCommonSubexpr();
+    void FuseCommands();
+    void CompileRegisters();
+    void CompileGradient();
+    static GradRule FindGradRule(const std::string &mnem);
 
     Cmdaddr MkCmd(int cmd, int addr) {return Cmdaddr(cmd, addr);}
 
@@ -117,10 +287,24 @@ Possible values of CmdType and associated actions:
     bool Validate();
 
     std::string GetErrorString() {return ErrorString;}
+    size_t GetStackDepth() const {return StackDepth;}
 
-private:
+// the result of ParseExpr() (and Validate()) as stored by VProgramCache
+    void GetProgram(VProgram &prg) const;
+    void SetProgram(const VProgram &prg); // the program is taken as validated
+// hash of the symbol tables the result of ParseExpr() depends on
+    uint64_t GetFingerprint() const;
+
+protected:
     size_t AddAutoConstant(double val);
+    void CompactConstants();
+
+private:
+    struct NoBuiltins {};
+    explicit VParser(NoBuiltins) {;}
+    static const VParser &Builtins(); // the parser with the default operations and functions
     void PruneConstants();
+    bool AppendExpr(const std::string &expr);
 
     std::string Expr;
     size_t TokPos = 0; // current token position in Expr
@@ -129,50 +313,172 @@ private:
     std::string ErrorString;
     size_t pow2, pow3; // positions of the fast square and cube functions
     size_t neg, nop; // position of the sign inverse and nop functions 
+    size_t opadd, opsub, opmul, opdiv; // positions of the arithmetic operations
     bool valid = true; // result of the code validity check
 public:    
     size_t failpos; // position in the code at which validation failed
 };
 
+// Everything ParseExpr() produces, for VProgramCache
+struct VProgram {
+    std::vector <VParser::Cmdaddr> Command;
+    std::vector <VParser::Cmdaddr> HoistCode;
+    std::vector <double> AutoConst;      // the nameless constants, following the named ones in Const
+    std::vector <std::string> VarName;   // including the variables created by the expression
+    std::vector <VParser::RegCmd> RegCode;
+    size_t RegCount = 0;
+    size_t StackDepth = 0;
+};
+
+// scalar type of VarType: VarType itself for the scalar types, VarType::Scalar for Eigen arrays
+template <typename VarType, bool = std::is_scalar<VarType>::value>
+struct VScalarType { typedef VarType type; };
+
+template <typename VarType>
+struct VScalarType <VarType, false> { typedef typename VarType::Scalar type; };
+
+template <typename VarType> class VFormulaSet;
+
 template <typename VarType> 
 class VFormula : public VParser
 {
-    typedef void (VFormula::*FuncPtr)();
+    friend class VFormulaSet <VarType>;
+
+public:
+    typedef typename VScalarType<VarType>::type Scalar;
+
+// Evaluation state: everything the evaluator writes to during Eval().
+// Eval(Context&) does not modify the formula itself, so a parsed and validated
+// formula can be shared by several threads, each evaluating with its own Context.
+    struct Context {
+        std::vector <VarType> Var;    // vector of variables
+        std::vector <VarType> Stack;  // evaluator stack, preallocated to the depth found by Validate()
+        int veclen = 0;               // length of vectors to operate
+    // batch evaluator memory
+        std::vector <VarType> BatchStack;        // stack of columns, BatchSize elements each
+        std::vector <VarType> BatchVar;          // columns of the variables assigned in the program
+        std::vector <const VarType*> BatchCol;   // current column of each variable
+        std::vector <VarType> MixedIn, MixedOut; // converted inputs and output of EvalBatch() for other types
+        std::vector <const VarType*> MixedCol;
+    // register machine memory
+        std::vector <VarType> Reg;               // temporary registers
+        std::vector <VarType*> RegPtr;           // all registers: variables followed by temporaries
+    // tiled evaluation memory
+        std::vector <VarType> FullVar;           // full-length variables while Var holds their tiles
+        std::vector <VarType> TailVar, TailStack, TailReg; // Var, Stack and Reg for the shorter last tile
+    // gradient evaluator memory
+        std::vector <VarType> GradVal;           // values of GradCode
+        std::vector <VarType> GradAdj;           // derivatives of the result with respect to them
+    // variables bound to caller-owned buffers, see Bind()
+        std::vector <const char*> Bound;         // first element of every variable, null if not bound
+        std::vector <size_t> BoundStride;        // distance between its elements in bytes
+        size_t BoundLen = 0;                     // number of elements of the bound buffers
+        std::vector <VarType> Gathered;          // batch columns of the strided variables
+        std::vector <const VarType*> GatheredCol;
+    // reduction memory
+        std::vector <Scalar> ReduceVal;          // values and terms of one chunk
+        std::vector <Scalar> BlockSum;           // sums of the terms of every BatchSize points
+    };
+
+// number of points the batch evaluator processes with one pass over the program
+    static const size_t BatchSize = 256;
+
+// evaluator used by Eval(): the stack machine running Command or the register machine running RegCode
+    enum Backend {
+        StackMachine = 0,
+        RegisterMachine
+    };
+
+// accuracy of exp, log, sin, cos and pow (function and operator), see SetAccuracy()
+    enum Accuracy {
+        Exact = 0, // cmath
+        Approx12,  // relative error below 1e-12
+        Approx6    // relative error below 1e-6
+    };
+
+// sums computed by Reduce() over the points of the bound buffers, w being the optional weights
+    enum Reduction {
+        ReduceSum = 0, // sum of w*f
+        ReduceChi2,    // sum of w*((f-y)/sigma)^2
+        ReduceNegLogL  // -sum of w*log(f)
+    };
+
+private:
+// operations and functions take their arguments in a and b and store the result in r
+// r may refer to the same object as a or b; b is not used by the functions of one argument
+    typedef void (*FuncPtr)(VarType &r, const VarType &a, const VarType &b);
 
-    std::vector <VarType> Var;    // vector of variables
-    std::stack <VarType> Stack;   // evaluator stack
     std::vector <FuncPtr> Func;  // vector of function pointers 
     std::vector <FuncPtr> Oper;  // vector of operator pointers 
 
-    int veclen = 0;         // length of vectors to operate
-
-    void Add() {VarType tmp = Stack.top(); Stack.pop(); Stack.top() += tmp;}
-    void Sub() {VarType tmp = Stack.top(); Stack.pop(); Stack.top() -= tmp;}
-    void Mul() {VarType tmp = Stack.top(); Stack.pop(); Stack.top() *= tmp;}
-    void Div() {VarType tmp = Stack.top(); Stack.pop(); Stack.top() /= tmp;}
-    void Neg() {Stack.top() = -Stack.top();}
-    void Nop() {;}
-    void Pow() {VarType tmp = Stack.top(); Stack.pop(); Stack.top() = pow(Stack.top(), tmp);}
-    void Pow2() {VarType tmp = Stack.top(); Stack.top() = tmp*tmp;}
-    void Pow3() {VarType tmp = Stack.top(); Stack.top() = tmp*tmp*tmp;}
-
-    void Sqrt() {Stack.top() = sqrt(Stack.top());}
-    void Exp() {Stack.top() = exp(Stack.top());}
-    void Log() {Stack.top() = log(Stack.top());}
-    void Sin() {Stack.top() = sin(Stack.top());}
-    void Cos() {Stack.top() = cos(Stack.top());}
-    void Tan() {Stack.top() = tan(Stack.top());}
-    void Asin() {Stack.top() = asin(Stack.top());}
-    void Acos() {Stack.top() = acos(Stack.top());}
-    void Atan() {Stack.top() = atan(Stack.top());}
-//    void Atan2() {double x = Stack.top(); Stack.pop(); Stack.top() = atan2(Stack.top(), x);} //atan2(y,x)
-
-    void Sinh() {Stack.top() = sinh(Stack.top());}
-    void Cosh() {Stack.top() = cosh(Stack.top());}
-    void Tanh() {Stack.top() = tanh(Stack.top());}
-    void Asinh() {Stack.top() = asinh(Stack.top());}
-    void Acosh() {Stack.top() = acosh(Stack.top());}
-    void Atanh() {Stack.top() = atanh(Stack.top());}
+    typedef void (*BatchPtr)(VarType *r, const VarType *a, const VarType *b, size_t n);
+    std::vector <BatchPtr> BatchFunc;  // column versions of the functions
+    std::vector <BatchPtr> BatchOper;  // column versions of the operators
+    std::vector <BatchPtr> SimdFunc;   // BatchFunc and BatchOper with the SIMD kernels where available
+    std::vector <BatchPtr> SimdOper;
+    bool SimdMath = false;             // EvalBatch() uses SimdFunc and SimdOper
+
+    Context Ctx; // default context used by Eval() and Get/SetVariable() without explicit context
+
+// Const converted to Scalar, kept by Prepare() and by the AddConstant() and SetConstant() of VFormula;
+// for double the evaluators read Const itself
+    std::vector <Scalar> TypedConst;
+    Context HoistCtx; // context computing the constants of HoistCode
+
+    const Scalar *ConstData() const
+    {
+        if constexpr(std::is_same<Scalar, double>::value)
+            return Const.data();
+        else
+            return TypedConst.data();
+    }
+
+    void SyncConst()
+    {
+        if constexpr(!std::is_same<Scalar, double>::value)
+            TypedConst.assign(Const.begin(), Const.end());
+    }
+
+// pre-decoded command of the direct-threaded stack machine
+    struct ThreadedCmd {
+        const void *label;     // address of the command handler in RunThreaded()
+        FuncPtr fn;            // kernel of the operation or function
+        unsigned short addr;
+    };
+    std::vector <ThreadedCmd> ThreadedCode; // Command decoded for RunThreaded(), empty if unavailable
+
+    VJit Jit; // native code generated by Compile()
+    Backend Mode = StackMachine;
+    Accuracy Precision = Exact;
+    size_t TileSize = 4096; // vectors longer than that are evaluated tile by tile, 0 - never
+
+    static void Add(VarType &r, const VarType &a, const VarType &b) {r = a + b;}
+    static void Sub(VarType &r, const VarType &a, const VarType &b) {r = a - b;}
+    static void Mul(VarType &r, const VarType &a, const VarType &b) {r = a * b;}
+    static void Div(VarType &r, const VarType &a, const VarType &b) {r = a / b;}
+    static void Neg(VarType &r, const VarType &a, const VarType &) {r = -a;}
+    static void Nop(VarType &r, const VarType &a, const VarType &) {r = a;}
+    static void Pow(VarType &r, const VarType &a, const VarType &b) {r = pow(a, b);}
+    static void Pow2(VarType &r, const VarType &a, const VarType &) {r = a*a;}
+    static void Pow3(VarType &r, const VarType &a, const VarType &) {r = a*a*a;}
+
+    static void Sqrt(VarType &r, const VarType &a, const VarType &) {r = sqrt(a);}
+    static void Exp(VarType &r, const VarType &a, const VarType &) {r = exp(a);}
+    static void Log(VarType &r, const VarType &a, const VarType &) {r = log(a);}
+    static void Sin(VarType &r, const VarType &a, const VarType &) {r = sin(a);}
+    static void Cos(VarType &r, const VarType &a, const VarType &) {r = cos(a);}
+    static void Tan(VarType &r, const VarType &a, const VarType &) {r = tan(a);}
+    static void Asin(VarType &r, const VarType &a, const VarType &) {r = asin(a);}
+    static void Acos(VarType &r, const VarType &a, const VarType &) {r = acos(a);}
+    static void Atan(VarType &r, const VarType &a, const VarType &) {r = atan(a);}
+//    static void Atan2(VarType &r, const VarType &a, const VarType &b) {r = atan2(a, b);} //atan2(y,x)
+
+    static void Sinh(VarType &r, const VarType &a, const VarType &) {r = sinh(a);}
+    static void Cosh(VarType &r, const VarType &a, const VarType &) {r = cosh(a);}
+    static void Tanh(VarType &r, const VarType &a, const VarType &) {r = tanh(a);}
+    static void Asinh(VarType &r, const VarType &a, const VarType &) {r = asinh(a);}
+    static void Acosh(VarType &r, const VarType &a, const VarType &) {r = acosh(a);}
+    static void Atanh(VarType &r, const VarType &a, const VarType &) {r = atanh(a);}
 
 //    void Int() {double t; modf(Stack.top(), &t); Stack.top() = t;}
 //    void Frac() {double t; Stack.top() = modf(Stack.top(), &t);}
@@ -189,177 +495,1656 @@ class VFormula : public VParser
     void Min() {VarType tmp = Stack.top(); Stack.pop(); Stack.top() = std::min(tmp, Stack.top());}
     #endif    
 */
-    void Abs() 
+    static void Abs(VarType &r, const VarType &a, const VarType &) 
     {    
         if constexpr(std::is_scalar<VarType>::value)
-            Stack.top() = fabs(Stack.top());
+            r = fabs(a);
         else
-            Stack.top() = abs(Stack.top());
+            r = abs(a);
     }
 
-    void Max()
+    static void Max(VarType &r, const VarType &a, const VarType &b)
     {
-        if constexpr(std::is_scalar<VarType>::value) {
-            VarType tmp = Stack.top(); Stack.pop(); Stack.top() = std::max(tmp, Stack.top());
-        } else {
-            VarType tmp = Stack.top(); Stack.pop(); Stack.top() = tmp.max(Stack.top());
-        }        
+        if constexpr(std::is_scalar<VarType>::value)
+            r = std::max(b, a);
+        else
+            r = b.max(a);
     }
 
-    void Min()
+    static void Min(VarType &r, const VarType &a, const VarType &b)
     {
-        if constexpr(std::is_scalar<VarType>::value) {
-            VarType tmp = Stack.top(); Stack.pop(); Stack.top() = std::min(tmp, Stack.top());
-        } else {
-            VarType tmp = Stack.top(); Stack.pop(); Stack.top() = tmp.min(Stack.top());
-        }        
+        if constexpr(std::is_scalar<VarType>::value)
+            r = std::min(b, a);
+        else
+            r = b.min(a);
     }
 
     // void Gaus();
     // void Pol2();
     // void Pol3();
 
-    void MkOper(FuncPtr op, std::string mnem)
+// column version of an operation or a function used by the batch evaluator
+// r may be the same column as a or b, so the blocks of fixed length go through a local array:
+// that lets the compiler vectorize the arithmetic already at -O2, with as many points per
+// instruction as VarType allows (twice as many for float as for double)
+    static const size_t ColumnBlock = 16;
+
+// r[k] = f(k) for k < n
+    template <typename F>
+    static void ForColumn(VarType *r, size_t n, F f)
+    {
+        size_t i = 0;
+        for (; i+ColumnBlock <= n; i += ColumnBlock) {
+            VarType v[ColumnBlock];
+            for (size_t j=0; j<ColumnBlock; j++)
+                v[j] = f(i+j);
+            std::memcpy(r+i, v, sizeof v);
+        }
+        for (; i<n; i++)
+            r[i] = f(i);
+    }
+
+    template <FuncPtr op>
+    static void Column(VarType *r, const VarType *a, const VarType *b, size_t n)
+    {
+        ForColumn(r, n, [a, b](size_t k) {VarType v; op(v, a[k], b[k]); return v;});
+    }
+
+    template <FuncPtr op>
+    void MkOper(std::string mnem)
     {
         size_t addr;
-        if (FindSymbol(OperMnem, mnem, &addr))
-            Oper[addr] = op;
-        else
+        if (!FindSymbol(OperMnem, mnem, &addr))
             throw std::runtime_error(std::string("VFormula: Unknown operation ") + mnem);
+        Oper[addr] = op;
+        if constexpr(std::is_scalar<VarType>::value)
+            BatchOper[addr] = Column<op>;
     }
 
-    void MkFunc(FuncPtr func, std::string mnem)
+    template <FuncPtr func>
+    void MkFunc(std::string mnem)
     {
         size_t addr;
-        if (FindSymbol(FuncMnem, mnem, &addr))
-            Func[addr] = func;
-        else
+        if (!FindSymbol(FuncMnem, mnem, &addr))
             throw std::runtime_error(std::string("VFormula: Unknown function ") + mnem);
+        Func[addr] = func;
+        if constexpr(std::is_scalar<VarType>::value)
+            BatchFunc[addr] = Column<func>;
     }
 
-public:
-    VFormula() {
-        Oper.resize(OperName.size());
-        Func.resize(FuncName.size());
-        Var.resize(VarName.size());
-
-        MkOper(&VFormula::Add, "ADD");
-        MkOper(&VFormula::Sub, "SUB");
-        MkOper(&VFormula::Mul, "MUL");
-        MkOper(&VFormula::Div, "DIV");
-        MkOper(&VFormula::Pow, "POW");
-        MkOper(&VFormula::Neg, "NEG");
-        MkOper(&VFormula::Nop, "NOP");
-
-        MkFunc(&VFormula::Pow2, "POW2");
-        MkFunc(&VFormula::Pow3, "POW3");
-        MkFunc(&VFormula::Pow, "POW");
-        MkFunc(&VFormula::Abs, "ABS");
-        MkFunc(&VFormula::Sqrt, "SQRT");
-        MkFunc(&VFormula::Exp, "EXP");
-        MkFunc(&VFormula::Log, "LOG");
-
-        MkFunc(&VFormula::Sin, "SIN");
-        MkFunc(&VFormula::Cos, "COS");
-        MkFunc(&VFormula::Tan, "TAN");
-        MkFunc(&VFormula::Asin, "ASIN");        
-        MkFunc(&VFormula::Acos, "ACOS");
-        MkFunc(&VFormula::Atan, "ATAN");
-
-        MkFunc(&VFormula::Sinh, "SINH");
-        MkFunc(&VFormula::Cosh, "COSH");
-        MkFunc(&VFormula::Tanh, "TANH");
-        MkFunc(&VFormula::Asinh, "ASINH");        
-        MkFunc(&VFormula::Acosh, "ACOSH");
-        MkFunc(&VFormula::Atanh, "ATANH");
-
-        MkFunc(&VFormula::Max, "MAX");
-        MkFunc(&VFormula::Min, "MIN");
-
+// An approximation of VApprox as a kernel: applied to a scalar or to the coefficients of an Eigen type.
+// It is only registered if the elements of VarType are double.
+    template <VSimd::Kernel approx>
+    static void Approx(VarType &r, const VarType &a, const VarType &b)
+    {
+        if constexpr(std::is_scalar<VarType>::value)
+            approx(&r, &a, &b, 1);
+        else {
+            r.resize(a.size());
+            approx(r.data(), a.data(), b.data(), a.size());
+        }
     }
 
-    int ParseExpr(std::string expr)
+    static constexpr bool DoubleElements()
     {
-        int errpos = VParser::ParseExpr(expr);
-        Var.resize(VarName.size());
-        return errpos;
+        if constexpr(std::is_scalar<VarType>::value)
+            return std::is_same<VarType, double>::value;
+        else
+            return std::is_same<typename VarType::Scalar, double>::value;
     }
 
-    VarType GetVariable(std::string name)
+// the batch evaluator calls the column kernel of VApprox directly
+    template <VSimd::Kernel approx>
+    void MkApprox(std::string mnem)
     {
         size_t addr;
-        return FindSymbol(VarName, name, &addr) ? Var[addr] : VarType(0);
+        if (FindSymbol(OperMnem, mnem, &addr)) {
+            MkOper<Approx<approx>>(mnem);
+            if constexpr(std::is_scalar<VarType>::value)
+                BatchOper[addr] = approx;
+        }
+        MkFunc<Approx<approx>>(mnem);
+        FindSymbol(FuncMnem, mnem, &addr);
+        if constexpr(std::is_scalar<VarType>::value)
+            BatchFunc[addr] = approx;
     }
 
-    bool SetVariable(std::string name, VarType val)
+// (re)registers the functions affected by the accuracy: cmath for Digits == 0
+    template <int Digits>
+    void MkMath()
     {
-        size_t addr;
-        bool status = FindSymbol(VarName, name, &addr);
-        if (status)
-            Var[addr] = val;
-        return status;    
+        if constexpr(Digits == 0) {
+            MkOper<VFormula::Pow>("POW");
+            MkFunc<VFormula::Pow>("POW");
+            MkFunc<VFormula::Exp>("EXP");
+            MkFunc<VFormula::Log>("LOG");
+            MkFunc<VFormula::Sin>("SIN");
+            MkFunc<VFormula::Cos>("COS");
+        } else {
+            MkApprox<VApprox::Pow<Digits>>("POW");
+            MkApprox<VApprox::Exp<Digits>>("EXP");
+            MkApprox<VApprox::Log<Digits>>("LOG");
+            MkApprox<VApprox::Sin<Digits>>("SIN");
+            MkApprox<VApprox::Cos<Digits>>("COS");
+        }
+    }
+    void MkMath(Accuracy acc)
+    {
+        if (acc == Approx12)
+            MkMath<12>();
+        else if (acc == Approx6)
+            MkMath<6>();
+        else
+            MkMath<0>();
     }
 
-    VarType Eval()
+// the batch kernels with those of VSimd substituted where available
+    void MkSimd()
     {
-        size_t codelen = Command.size();
+        SimdOper = BatchOper;
+        SimdFunc = BatchFunc;
+        if constexpr(std::is_same<VarType, double>::value) {
+            for (size_t i=0; i<OperMnem.size(); i++)
+                if (VSimd::Kernel k = VSimd::Find(OperMnem[i]))
+                    SimdOper[i] = k;
+            for (size_t i=0; i<FuncMnem.size(); i++)
+                if (VSimd::Kernel k = VSimd::Find(FuncMnem[i]))
+                    SimdFunc[i] = k;
+        }
+    }
+
+// runs the selected backend, the result stays in the context
+    const VarType &Result(Context &ctx) const
+    {
+        if (Mode == RegisterMachine)
+            return RunRegisters(ctx);
+        #ifdef VFORMULA_THREADED_CODE
+        if (!ThreadedCode.empty())
+            return RunThreaded(ThreadedCode.data(), ctx);
+        #endif
+        return Run(Command.data(), Command.size(), ctx);
+    }
+
+// sets the first variable (x), for vectors also the vector length
+    void SetX(Context &ctx, const VarType &x) const
+    {
+        if (ctx.Var.size() < VarName.size())
+            ctx.Var.resize(VarName.size());
+        ctx.Var[0] = x;
+        if constexpr(!std::is_scalar<VarType>::value)
+            ctx.veclen = x.size();
+    }
+
+// true if Eval() splits the vectors of the context into tiles
+    bool Tiled(const Context &ctx) const
+    {
+        if constexpr(std::is_scalar<VarType>::value)
+            return false;
+        else
+            return VarType::IsVectorAtCompileTime && TileSize != 0 && (size_t)ctx.veclen > TileSize;
+    }
+
+// Runs the whole program on one tile of TileSize elements of every variable before moving
+// to the next tile, so that the stack stays in cache instead of streaming every command
+// through memory. The tile size is rounded down to a multiple of 16 elements: every tile then
+// starts at a SIMD packet boundary, and Eigen computes each element exactly as it does for
+// the whole vector. The shorter last tile has its own set of vectors in the context, so that
+// neither set is ever resized. The assigned variables of the context are not updated, but the
+// tiles of nout of them (addresses in outvar) can be collected in out.
+// The tiles of the variables bound to external buffers (see Bind()) are read from the buffers;
+// result can also be an Eigen::Map of the caller's memory. With TileSize 0 there is one tile.
+    template <typename Out>
+    void RunTiled(Context &ctx, Out &&result, const size_t *outvar = nullptr, VarType *out = nullptr, size_t nout = 0) const
+    {
+        if constexpr(!std::is_scalar<VarType>::value) {
+            const int n = ctx.veclen;
+            const int tile = TileSize != 0 ? std::max<int>(16, TileSize/16*16) : n;
+            const size_t nbound = std::min(ctx.Bound.size(), VarName.size());
+            const size_t nvar = VarName.size();
+            if (ctx.Var.size() < nvar)
+                ctx.Var.resize(nvar);
+            std::swap(ctx.Var, ctx.FullVar);
+            ctx.Var.resize(ctx.FullVar.size());
+            ctx.TailVar.resize(ctx.FullVar.size());
+            result.resize(n);
+            for (size_t k=0; k<nout; k++)
+                out[k].resize(n);
+
+            for (int off = 0; off < n; off += tile) {
+                int len = std::min(tile, n - off);
+                bool tail = len != tile;
+                if (tail) {
+                    std::swap(ctx.Var, ctx.TailVar);
+                    std::swap(ctx.Stack, ctx.TailStack);
+                    std::swap(ctx.Reg, ctx.TailReg);
+                }
+                // the variables of other lengths can only be those assigned by the program
+                for (size_t i=0; i<ctx.Var.size(); i++)
+                    if (i < nbound && ctx.Bound[i]) {
+                        ctx.Var[i].resize(len);
+                        Gather(ctx, i, off, len, ctx.Var[i].data());
+                    }
+                    else if (ctx.FullVar[i].size() == n)
+                        ctx.Var[i] = ctx.FullVar[i].segment(off, len);
+                ctx.veclen = len;
+                result.segment(off, len) = Result(ctx);
+                for (size_t k=0; k<nout; k++)
+                    out[k].segment(off, len) = ctx.Var[outvar[k]];
+                if (tail) {
+                    std::swap(ctx.Var, ctx.TailVar);
+                    std::swap(ctx.Stack, ctx.TailStack);
+                    std::swap(ctx.Reg, ctx.TailReg);
+                }
+            }
+            std::swap(ctx.Var, ctx.FullVar);
+            ctx.veclen = n;
+        }
+    }
+
+// copies n elements, starting from element first, of the variable bound to slot v to dst
+    static void Gather(const Context &ctx, size_t v, size_t first, size_t n, Scalar *dst)
+    {
+        const size_t stride = ctx.BoundStride[v];
+        const char *src = ctx.Bound[v] + first*stride;
+        if (stride == sizeof(Scalar))
+            std::memcpy(dst, src, n*sizeof(Scalar));
+        else
+            for (size_t k=0; k<n; k++)
+                std::memcpy(dst + k, src + k*stride, sizeof(Scalar));
+    }
+
+// Pairwise sum: the rounding error grows as log(n) instead of n, and the result depends only on
+// the values and their order.
+    static Scalar PairwiseSum(const Scalar *a, size_t n)
+    {
+        if (n <= 16) {
+            Scalar sum = 0;
+            for (size_t i=0; i<n; i++)
+                sum += a[i];
+            return sum;
+        }
+        const size_t half = n/2;
+        return PairwiseSum(a, half) + PairwiseSum(a + half, n - half);
+    }
+
+// Evaluates len points of the bound buffers from start on (a multiple of BatchSize) and stores
+// the sums of their terms, BatchSize points each, in blocksum.
+    void ReduceChunk(Context &ctx, Reduction r, size_t start, size_t len,
+                     const Scalar *w, const Scalar *y, const Scalar *sigma, Scalar *blocksum) const
+    {
+        const size_t n = ctx.BoundLen;
+        for (size_t v=0; v<ctx.Bound.size(); v++)
+            if (ctx.Bound[v])
+                ctx.Bound[v] += start*ctx.BoundStride[v];
+        ctx.BoundLen = len;
+        ctx.ReduceVal.resize(16*BatchSize);
+        Scalar *f = ctx.ReduceVal.data();
+        EvalInto(ctx, f);
+        for (size_t v=0; v<ctx.Bound.size(); v++)
+            if (ctx.Bound[v])
+                ctx.Bound[v] -= start*ctx.BoundStride[v];
+        ctx.BoundLen = n;
+
+        if (r == ReduceChi2) {
+            for (size_t k=0; k<len; k++) {
+                Scalar d = y ? f[k] - y[start+k] : f[k];
+                if (sigma)
+                    d /= sigma[start+k];
+                f[k] = d*d;
+            }
+        }
+        else if (r == ReduceNegLogL) {
+            for (size_t k=0; k<len; k++)
+                f[k] = -std::log(f[k]);
+        }
+        if (w)
+            for (size_t k=0; k<len; k++)
+                f[k] *= w[start+k];
+        for (size_t b=0; b*BatchSize<len; b++)
+            blocksum[b] = PairwiseSum(f + b*BatchSize, std::min(BatchSize, len - b*BatchSize));
+    }
+
+// the result of an empty program: zero, kept in the first stack slot of the context
+    const VarType &ReturnZero(Context &ctx) const
+    {
+        if (ctx.Stack.empty())
+            ctx.Stack.resize(1);
+        if constexpr(std::is_scalar<VarType>::value)
+            ctx.Stack[0] = VarType(0);
+        else
+            ctx.Stack[0].setZero(ctx.veclen);
+        return ctx.Stack[0];
+    }
+
+// the stack machine: runs codelen commands starting from code on the given context;
+// the result is returned in place (a stack slot of the context) to avoid copying vectors
+    const VarType &Run(const Cmdaddr *code, size_t codelen, Context &ctx) const
+    {
+        if (ctx.Var.size() < VarName.size()) // the formula was re-parsed after the context was made
+            ctx.Var.resize(VarName.size());
+        if (ctx.Stack.size() < StackDepth)
+            ctx.Stack.resize(StackDepth);
+        std::vector <VarType> &Var = ctx.Var;
+        VarType *sp = ctx.Stack.data(); // points to the first free stack position
+        const Scalar *cnst = ConstData();
+
         for (size_t i=0; i<codelen; i++) {
-            unsigned short cmd = Command[i].cmd;
-            unsigned short addr = Command[i].addr;
+            unsigned short cmd = code[i].cmd;
+            unsigned short addr = code[i].addr;
             switch (cmd) {
-                case CmdOper:
-                    (this->*Oper[addr])();
+                // n arguments are replaced by the result: the first one is at sp[-1],
+                // the second one (if any) is at sp[0] after the stack pointer is moved
+                case CmdOper: {
+                    int n = OperArgs[addr];
+                    sp -= n - 1;
+                    Oper[addr](sp[-1], sp[-1], sp[n-2]);
                     break;
-                case CmdFunc:
-                    (this->*Func[addr])();
+                }
+                case CmdFunc: {
+                    int n = FuncArgs[addr];
+                    sp -= n - 1;
+                    Func[addr](sp[-1], sp[-1], sp[n-2]);
                     break;
+                }
                 case CmdReadConst:
                     if constexpr(std::is_scalar<VarType>::value)
-                        Stack.push(Const[addr]);
+                        *sp++ = cnst[addr];
                     else
-                        Stack.push(VarType::Constant(veclen, Const[addr]));
+                        *sp++ = VarType::Constant(ctx.veclen, cnst[addr]);
                     break;
                 case CmdReadVar:
-                    Stack.push(Var[addr]);
+                    *sp++ = Var[addr];
                     break;
                 case CmdWriteVar:
-                    Var[addr] = Stack.top();
-                    Stack.pop();
-                    break;
-                case CmdReturn: {
-                    VarType result = Stack.top();
-                    Stack.pop();
-                    //std::cout << "Stack size: " << Stack.size() << std::endl;
-                    return result;
-                }
+                    Var[addr] = *--sp;
+                    break;
+                case CmdReturn:
+                    //std::cout << "Stack depth: " << sp - ctx.Stack.data() << std::endl;
+                    return *--sp;
+                case CmdAddConst:
+                    sp[-1] += cnst[addr];
+                    break;
+                case CmdSubConst:
+                    sp[-1] -= cnst[addr];
+                    break;
+                case CmdMulConst:
+                    sp[-1] *= cnst[addr];
+                    break;
+                case CmdDivConst:
+                    sp[-1] /= cnst[addr];
+                    break;
+                case CmdAddVar:
+                    sp[-1] += Var[addr];
+                    break;
+                case CmdSubVar:
+                    sp[-1] -= Var[addr];
+                    break;
+                case CmdMulVar:
+                    sp[-1] *= Var[addr];
+                    break;
+                case CmdDivVar:
+                    sp[-1] /= Var[addr];
+                    break;
+                case CmdMulAddConst:
+                    sp--;
+                    sp[-1] = sp[-1] * sp[0] + cnst[addr];
+                    break;
+                case CmdMulAddVar:
+                    sp--;
+                    sp[-1] = sp[-1] * sp[0] + Var[addr];
+                    break;
+                case CmdRSubConst:
+                    sp[-1] = cnst[addr] - sp[-1];
+                    break;
+                case CmdRDivConst:
+                    sp[-1] = cnst[addr] / sp[-1];
+                    break;
                 default: // unknown command means a bug in the parser
                     throw std::runtime_error(std::string("Eval: Unknown command ") + std::to_string(cmd));
             }
         }
         // empty program - return 0
+        return ReturnZero(ctx);
+    }
+
+// Translates Command into the direct-threaded form: each command carries the address of its
+// handler and, for operations and functions, the kernel pointer, so running it takes a single
+// indirect jump. The program is decoded only if it is complete, i.e. ends with CmdReturn.
+    void DecodeThreaded()
+    {
+        ThreadedCode.clear();
+        #ifdef VFORMULA_THREADED_CODE
+        if (Command.empty() || Command.back().cmd != CmdReturn)
+            return;
+        const void *const *labels;
+        Context dummy;
+        RunThreaded(nullptr, dummy, &labels);
+
+        for (const Cmdaddr &c : Command) {
+            ThreadedCmd tc;
+            tc.addr = c.addr;
+            tc.fn = nullptr;
+            if (c.cmd == CmdOper || c.cmd == CmdFunc) {
+                // handlers 1 and 2 call the kernels of one and two arguments
+                int nargs = c.cmd == CmdOper ? OperArgs[c.addr] : FuncArgs[c.addr];
+                tc.fn = c.cmd == CmdOper ? Oper[c.addr] : Func[c.addr];
+                tc.label = labels[nargs];
+            } else
+                tc.label = labels[c.cmd];
+            ThreadedCode.push_back(tc);
+        }
+        #endif
+    }
+
+#ifdef VFORMULA_THREADED_CODE
+// The direct-threaded stack machine. Called with code == nullptr, it only returns its table
+// of handler addresses in labels: the table is indexed by CmdType, except that entries 1 and 2
+// are the handlers for operations/functions of one and two arguments respectively.
+    const VarType &RunThreaded(const ThreadedCmd *code, Context &ctx, const void *const **labels = nullptr) const
+    {
+        static const void *const table[] = {
+            &&l_nop, &&l_call1, &&l_call2, &&l_readconst, &&l_readvar, &&l_writevar, &&l_return,
+            &&l_addconst, &&l_subconst, &&l_mulconst, &&l_divconst,
+            &&l_addvar, &&l_subvar, &&l_mulvar, &&l_divvar,
+            &&l_muladdconst, &&l_muladdvar, &&l_rsubconst, &&l_rdivconst
+        };
+        if (!code) {
+            *labels = table;
+            return ReturnZero(ctx);
+        }
+
+        if (ctx.Var.size() < VarName.size())
+            ctx.Var.resize(VarName.size());
+        if (ctx.Stack.size() < StackDepth)
+            ctx.Stack.resize(StackDepth);
+        std::vector <VarType> &Var = ctx.Var;
+        VarType *sp = ctx.Stack.data(); // points to the first free stack position
+        const Scalar *cnst = ConstData();
+
+        goto *code->label;
+
+    l_nop:
+        goto *(++code)->label;
+    l_call1:
+        code->fn(sp[-1], sp[-1], sp[-1]);
+        goto *(++code)->label;
+    l_call2:
+        sp--;
+        code->fn(sp[-1], sp[-1], sp[0]);
+        goto *(++code)->label;
+    l_readconst:
         if constexpr(std::is_scalar<VarType>::value)
-            return 0.;
+            *sp++ = cnst[code->addr];
         else
-            return VarType::Constant(veclen, 0.);
+            *sp++ = VarType::Constant(ctx.veclen, cnst[code->addr]);
+        goto *(++code)->label;
+    l_readvar:
+        *sp++ = Var[code->addr];
+        goto *(++code)->label;
+    l_writevar:
+        Var[code->addr] = *--sp;
+        goto *(++code)->label;
+    l_return:
+        return *--sp;
+    l_addconst:
+        sp[-1] += cnst[code->addr];
+        goto *(++code)->label;
+    l_subconst:
+        sp[-1] -= cnst[code->addr];
+        goto *(++code)->label;
+    l_mulconst:
+        sp[-1] *= cnst[code->addr];
+        goto *(++code)->label;
+    l_divconst:
+        sp[-1] /= cnst[code->addr];
+        goto *(++code)->label;
+    l_addvar:
+        sp[-1] += Var[code->addr];
+        goto *(++code)->label;
+    l_subvar:
+        sp[-1] -= Var[code->addr];
+        goto *(++code)->label;
+    l_mulvar:
+        sp[-1] *= Var[code->addr];
+        goto *(++code)->label;
+    l_divvar:
+        sp[-1] /= Var[code->addr];
+        goto *(++code)->label;
+    l_muladdconst:
+        sp--;
+        sp[-1] = sp[-1] * sp[0] + cnst[code->addr];
+        goto *(++code)->label;
+    l_muladdvar:
+        sp--;
+        sp[-1] = sp[-1] * sp[0] + Var[code->addr];
+        goto *(++code)->label;
+    l_rsubconst:
+        sp[-1] = cnst[code->addr] - sp[-1];
+        goto *(++code)->label;
+    l_rdivconst:
+        sp[-1] = cnst[code->addr] / sp[-1];
+        goto *(++code)->label;
     }
+#endif
 
-    VarType Eval(VarType x)
+// the register machine: runs RegCode on the given context, the result is returned in place
+    const VarType &RunRegisters(Context &ctx) const
     {
-        Var[0] = x;
-        if constexpr(!std::is_scalar<VarType>::value)
-            veclen = x.size();
-        return Eval();
+        const size_t nvar = VarName.size();
+        if (ctx.Var.size() < nvar)
+            ctx.Var.resize(nvar);
+        if (ctx.Reg.size() < RegCount - nvar)
+            ctx.Reg.resize(RegCount - nvar);
+        ctx.RegPtr.resize(RegCount);
+        VarType **r = ctx.RegPtr.data();
+        for (size_t i=0; i<nvar; i++)
+            r[i] = &ctx.Var[i];
+        for (size_t i=nvar; i<RegCount; i++)
+            r[i] = &ctx.Reg[i-nvar];
+        const Scalar *cnst = ConstData();
+
+        for (const RegCmd &c : RegCode) {
+            switch (c.cmd) {
+                case CmdOper:
+                    Oper[c.addr](*r[c.dst], *r[c.a], *r[c.b]);
+                    break;
+                case CmdFunc:
+                    Func[c.addr](*r[c.dst], *r[c.a], *r[c.b]);
+                    break;
+                case CmdReadConst:
+                    if constexpr(std::is_scalar<VarType>::value)
+                        *r[c.dst] = cnst[c.addr];
+                    else
+                        *r[c.dst] = VarType::Constant(ctx.veclen, cnst[c.addr]);
+                    break;
+                case CmdWriteVar:
+                    *r[c.dst] = *r[c.a];
+                    break;
+                case CmdReturn:
+                    return *r[c.a];
+                case CmdAddConst:
+                    *r[c.dst] = *r[c.a] + cnst[c.addr];
+                    break;
+                case CmdSubConst:
+                    *r[c.dst] = *r[c.a] - cnst[c.addr];
+                    break;
+                case CmdMulConst:
+                    *r[c.dst] = *r[c.a] * cnst[c.addr];
+                    break;
+                case CmdDivConst:
+                    *r[c.dst] = *r[c.a] / cnst[c.addr];
+                    break;
+                case CmdMulAddConst:
+                    *r[c.dst] = *r[c.a] * *r[c.b] + cnst[c.addr];
+                    break;
+                case CmdMulAddVar:
+                    *r[c.dst] = *r[c.a] * *r[c.b] + *r[c.addr];
+                    break;
+                case CmdRSubConst:
+                    *r[c.dst] = cnst[c.addr] - *r[c.a];
+                    break;
+                case CmdRDivConst:
+                    *r[c.dst] = cnst[c.addr] / *r[c.a];
+                    break;
+                default: // unknown command means a bug in the compiler
+                    throw std::runtime_error(std::string("Eval: Unknown register command ") + std::to_string(c.cmd));
+            }
+        }
+        // empty program - return 0
+        return ReturnZero(ctx);
+    }
+
+// Replaces every subexpression built only of numbers (i.e. auto constants) with a single
+// auto constant. The subexpressions are evaluated with the exact kernels whatever the accuracy,
+// so the result does not depend on it or on whether SetAccuracy() comes before or after the parsing.
+// Named constants are not folded: they can be changed with SetConstant().
+    void FoldConstants()
+    {
+        if constexpr(DoubleElements())
+            if (Precision != Exact)
+                MkMath<0>();
+        struct Operand {
+            size_t start;  // position of the first command computing this operand
+            bool number;   // computed from numbers only
+        };
+        std::vector <Operand> operands;
+        std::vector <Cmdaddr> out;
+        Context scratch = MakeContext();
+        scratch.veclen = 1;
+
+        for (const Cmdaddr &c : Command) {
+            int nargs = -1; // stays negative for the commands which can not be folded
+            switch (c.cmd) {
+                case CmdReadConst:
+                    operands.push_back({out.size(), c.addr >= ConstName.size()});
+                    break;
+                case CmdReadVar:
+                    operands.push_back({out.size(), false});
+                    break;
+                case CmdOper:
+                    nargs = OperArgs[c.addr];
+                    break;
+                case CmdFunc:
+                    nargs = FuncArgs[c.addr];
+                    break;
+                case CmdWriteVar:
+                    operands.clear();
+                    break;
+            }
+            if (nargs > 0 && operands.size() >= (size_t)nargs) {
+                bool number = true;
+                for (size_t k=operands.size()-nargs; k<operands.size(); k++)
+                    number = number && operands[k].number;
+                size_t start = operands[operands.size()-nargs].start;
+                operands.resize(operands.size()-nargs);
+
+                if (number) {
+                    std::vector <Cmdaddr> sub(out.begin()+start, out.end());
+                    sub.push_back(c);
+                    sub.push_back(MkCmd(CmdReturn, 0));
+                    SyncConst(); // the numbers folded so far are in Const only
+                    VarType result = Run(sub.data(), sub.size(), scratch);
+                    double val;
+                    if constexpr(std::is_scalar<VarType>::value)
+                        val = result;
+                    else
+                        val = result[0];
+                    out.erase(out.begin()+start, out.end());
+                    out.push_back(MkCmd(CmdReadConst, AddAutoConstant(val)));
+                } else
+                    out.push_back(c);
+                operands.push_back({start, number});
+                continue;
+            }
+            out.push_back(c);
+        }
+        Command = out;
+        CompactConstants();
+        if constexpr(DoubleElements())
+            MkMath(Precision);
     }
 
-    VarType Eval(VarType x, VarType y)
+// Computes the constants of HoistCode with the kernels of the formula: all of them, or only those
+// reading the named constant changed. The values are stored as the other constants (see TypedConst).
+// A subexpression of anything but constants, operations and functions, or which does not leave
+// exactly one value on the stack, is skipped: it can only come with a corrupted loaded program.
+    void UpdateHoisted(size_t changed = size_t(-1))
     {
-        Var[0] = x;
-        Var[1] = y;
+        if (HoistCode.empty())
+            return;
+        if (HoistCtx.Stack.size() < HoistCode.size())
+            HoistCtx.Stack.resize(HoistCode.size());
+        HoistCtx.veclen = 1;
+        size_t start = 0;
+        bool dirty = changed == size_t(-1);
+        long depth = 0; // stack depth so far, negative once the subexpression is out of balance
+        for (size_t i=0; i<HoistCode.size(); i++) {
+            const Cmdaddr &c = HoistCode[i];
+            if (c.cmd == CmdReadConst && c.addr == changed)
+                dirty = true;
+            long nargs = c.cmd == CmdOper && c.addr < OperArgs.size() ? OperArgs[c.addr] :
+                         c.cmd == CmdFunc && c.addr < FuncArgs.size() ? FuncArgs[c.addr] :
+                         c.cmd == CmdReadConst && c.addr < Const.size() ? 0 : depth + 1;
+            if (c.cmd != CmdReturn) {
+                depth = depth >= nargs ? depth - nargs + 1 : -1;
+                continue;
+            }
+            if (dirty && depth == 1 && c.addr < Const.size()) {
+                const VarType &result = Run(HoistCode.data()+start, i+1-start, HoistCtx);
+                if constexpr(std::is_scalar<VarType>::value)
+                    Const[c.addr] = result;
+                else
+                    Const[c.addr] = result[0];
+                if constexpr(!std::is_same<Scalar, double>::value)
+                    if (c.addr < TypedConst.size())
+                        TypedConst[c.addr] = Scalar(Const[c.addr]);
+            }
+            start = i+1;
+            dirty = changed == size_t(-1);
+            depth = 0;
+        }
+    }
+
+// the formula with the default kernels, registered once for each VarType and copied into every new formula
+    struct NoKernels {};
+    explicit VFormula(NoKernels) {
+        Oper.resize(OperName.size());
+        Func.resize(FuncName.size());
+        BatchOper.resize(OperName.size());
+        BatchFunc.resize(FuncName.size());
+        Ctx.Var.resize(VarName.size());
+
+        MkOper<VFormula::Add>("ADD");
+        MkOper<VFormula::Sub>("SUB");
+        MkOper<VFormula::Mul>("MUL");
+        MkOper<VFormula::Div>("DIV");
+        MkOper<VFormula::Pow>("POW");
+        MkOper<VFormula::Neg>("NEG");
+        MkOper<VFormula::Nop>("NOP");
+
+        MkFunc<VFormula::Pow2>("POW2");
+        MkFunc<VFormula::Pow3>("POW3");
+        MkFunc<VFormula::Pow>("POW");
+        MkFunc<VFormula::Abs>("ABS");
+        MkFunc<VFormula::Sqrt>("SQRT");
+        MkFunc<VFormula::Exp>("EXP");
+        MkFunc<VFormula::Log>("LOG");
+
+        MkFunc<VFormula::Sin>("SIN");
+        MkFunc<VFormula::Cos>("COS");
+        MkFunc<VFormula::Tan>("TAN");
+        MkFunc<VFormula::Asin>("ASIN");        
+        MkFunc<VFormula::Acos>("ACOS");
+        MkFunc<VFormula::Atan>("ATAN");
+
+        MkFunc<VFormula::Sinh>("SINH");
+        MkFunc<VFormula::Cosh>("COSH");
+        MkFunc<VFormula::Tanh>("TANH");
+        MkFunc<VFormula::Asinh>("ASINH");        
+        MkFunc<VFormula::Acosh>("ACOSH");
+        MkFunc<VFormula::Atanh>("ATANH");
+
+        MkFunc<VFormula::Max>("MAX");
+        MkFunc<VFormula::Min>("MIN");
+
+        MkSimd();
+    }
+
+    static const VFormula &Builtins()
+    {
+        static const VFormula builtins{NoKernels()};
+        return builtins;
+    }
+
+// the optimization passes, run on the freshly parsed program
+    void Optimize()
+    {
+        FoldConstants();
+        HoistInvariants();
+        EliminateCommonSubexpr();
+        FuseCommands();
+        CompileRegisters();
+        StackDepth = Command.size(); // still a safe upper bound for the transformed program
+    }
+
+// parser and the optimization passes: everything ParseExpr() does except preparing the evaluation
+    int Translate(const std::string &expr)
+    {
+        int errpos = VParser::ParseExpr(expr);
+        if (errpos == 1024)
+            Optimize();
+        return errpos;
+    }
+
+// makes a new program ready for evaluation
+    void Prepare()
+    {
+        SyncConst();
+        UpdateHoisted();
+        if constexpr(std::is_floating_point<VarType>::value)
+            CompileGradient();
+        DecodeThreaded();
+        Jit.Clear();
+        Ctx.Var.resize(VarName.size());
+    }
+
+public:
+    VFormula() : VFormula(Builtins()) {;}
+
+    int ParseExpr(std::string expr)
+    {
+        int errpos = Translate(expr);
+        Prepare();
+        return errpos;
+    }
+
+// Parsing through a cache: if the same expression was parsed before with the same symbol tables
+// and VarType, the program is taken from the cache, skipping the parser and Validate().
+// Otherwise the expression is parsed and, if it passes Validate(), stored in the cache.
+// Returns the same as ParseExpr(). The cache can be shared by formulas in different threads.
+    int ParseExpr(VProgramCache &cache, const std::string &expr)
+    {
+        uint64_t fingerprint = GetFingerprint();
+        fingerprint = fingerprint * 31 + typeid(VarType).hash_code();
+
+        std::shared_ptr <const VProgram> prg = cache.Find(fingerprint, expr);
+        if (!prg) {
+            int errpos = ParseExpr(expr);
+            if (errpos == 1024 && Validate()) {
+                std::shared_ptr <VProgram> parsed = std::make_shared <VProgram>();
+                GetProgram(*parsed);
+                cache.Insert(fingerprint, expr, parsed);
+            }
+            return errpos;
+        }
+        LoadProgram(*prg);
+        return 1024;
+    }
+
+// Compiles many expressions at once on the threads of the pool. This formula serves as the
+// symbol table shared by all of them: each thread parses with its own copy of it, so the
+// constants, variables and kernels are set up only once per thread. Returns the validated
+// programs, to be loaded with LoadProgram() into formulas set up as this one, and stores
+// for every expression the result of ParseExpr() in errpos (1024 - success), or -1 if the
+// program did not pass Validate(). The programs of the failed expressions are empty.
+    std::vector <VProgram> CompileAll(VThreadPool &pool, const std::vector <std::string> &exprs, std::vector <int> &errpos) const
+    {
+        const size_t chunk = 64; // expressions per task
+        const size_t nvar = VarName.size();
+        std::vector <VProgram> programs(exprs.size());
+        errpos.assign(exprs.size(), 1024);
+        std::vector <std::unique_ptr <VFormula>> parsers(pool.GetThreadCount());
+
+        pool.Run((exprs.size() + chunk - 1) / chunk, [&](size_t task, unsigned worker) {
+            if (!parsers[worker]) {
+                parsers[worker].reset(new VFormula(*this));
+                parsers[worker]->Ctx = Context();
+            }
+            VFormula &vf = *parsers[worker];
+            size_t end = std::min(exprs.size(), (task + 1) * chunk);
+            for (size_t i = task * chunk; i < end; i++) {
+                vf.VarName.resize(nvar); // forget the variables created by the previous expression
+                errpos[i] = vf.Translate(exprs[i]);
+                if (errpos[i] != 1024)
+                    continue;
+                if (vf.Validate())
+                    vf.GetProgram(programs[i]);
+                else
+                    errpos[i] = -1;
+            }
+        });
+        return programs;
+    }
+
+// Takes a program made by CompileAll() or GetProgram() as the result of parsing, without checks.
+// This formula must have the same constants, declared variables, VarType and accuracy as the one
+// which made it; the values of the constants can differ.
+    void LoadProgram(const VProgram &prg)
+    {
+        SetProgram(prg);
+        Prepare();
+    }
+
+// The constants are stored as double and, for other types, also converted to the scalar type of
+// VarType, so that the evaluators do not convert them on every use. These versions keep both in
+// sync, the ones of VParser must not be called directly once the expression is parsed.
+// The subexpressions of the program which depend on the named constants only are computed once,
+// into hidden constants (see HoistInvariants()); changing a named constant recomputes those reading it.
+    bool AddConstant(std::string name, double val)
+    {
+        bool status = VParser::AddConstant(name, val);
+        SyncConst();
+        UpdateHoisted();
+        return status;
+    }
+
+    bool SetConstant(size_t addr, double val)
+    {
+        bool status = VParser::SetConstant(addr, val);
+        if constexpr(!std::is_same<Scalar, double>::value)
+            if (status && addr < TypedConst.size())
+                TypedConst[addr] = Scalar(val);
+        if (status)
+            UpdateHoisted(addr);
+        return status;
+    }
+
+    bool SetConstant(std::string name, double val)
+    {
+        size_t addr;
+        return FindSymbol(ConstName, name, &addr) && SetConstant(addr, val);
+    }
+
+// creates a fresh evaluation context for this formula, e.g. one per worker thread
+    Context MakeContext() const
+    {
+        Context ctx;
+        ctx.Var.resize(VarName.size());
+        return ctx;
+    }
+
+    VarType GetVariable(std::string name)
+    {
+        return GetVariable(Ctx, name);
+    }
+
+    VarType GetVariable(const Context &ctx, std::string name) const
+    {
+        size_t addr;
+        return FindSymbol(VarName, name, &addr) && addr < ctx.Var.size() ? ctx.Var[addr] : VarType(0);
+    }
+
+    bool SetVariable(std::string name, VarType val)
+    {
+        return SetVariable(Ctx, name, val);
+    }
+
+    bool SetVariable(Context &ctx, std::string name, VarType val) const
+    {
+        size_t addr;
+        bool status = FindSymbol(VarName, name, &addr);
+        if (status) {
+            if (ctx.Var.size() < VarName.size())
+                ctx.Var.resize(VarName.size());
+            ctx.Var[addr] = val;
+        }
+        return status;    
+    }
+
+// A variable can be looked up by name once and then addressed by its slot, the index in GetVarMap().
+// GetSlot() returns NoSlot for an unknown name.
+    static const size_t NoSlot = size_t(-1);
+
+    size_t GetSlot(const std::string &name) const
+    {
+        size_t addr;
+        return FindSymbol(VarName, name, &addr) ? addr : NoSlot;
+    }
+
+    bool SetVariable(Context &ctx, size_t slot, const VarType &val) const
+    {
+        if (slot >= VarName.size())
+            return false;
+        if (ctx.Var.size() < VarName.size())
+            ctx.Var.resize(VarName.size());
+        ctx.Var[slot] = val;
+        return true;
+    }
+
+    bool SetVariable(size_t slot, const VarType &val) {return SetVariable(Ctx, slot, val);}
+
+// Binds the variable in the slot to n elements of a buffer owned by the caller, which EvalInto(ctx, out)
+// then reads in place: for scalar VarType as the columns of EvalBatch(), for Eigen types tile by tile as in
+// the evaluation of long vectors, so only the tile being evaluated is copied. The buffer must stay valid
+// until the binding is removed with Unbind(). All bound buffers have the same length: false if n differs
+// from that of the other bound variables, or if there is no such slot.
+    bool Bind(Context &ctx, size_t slot, const Scalar *data, size_t n) const
+    {
+        return Bind(ctx, slot, data, sizeof(Scalar), 0, n);
+    }
+
+// Binds the variable to a field of type Scalar in an array of n records: element k is read at
+// base + k*stride + offset (bytes). Only the fields read by the formula are gathered, one batch
+// (scalar VarType) or tile (Eigen types) at a time, so the records need not be split into columns.
+    bool Bind(Context &ctx, size_t slot, const void *base, size_t stride, size_t offset, size_t n) const
+    {
+        if (slot >= VarName.size())
+            return false;
+        if (ctx.Bound.size() < VarName.size()) {
+            ctx.Bound.resize(VarName.size(), nullptr);
+            ctx.BoundStride.resize(VarName.size());
+        }
+        for (size_t i=0; i<ctx.Bound.size(); i++)
+            if (i != slot && ctx.Bound[i] && ctx.BoundLen != n)
+                return false;
+        ctx.Bound[slot] = static_cast<const char*>(base) + offset;
+        ctx.BoundStride[slot] = stride;
+        ctx.BoundLen = n;
+        return true;
+    }
+
+// the same for the member field of n records, e.g. Bind(ctx, slot, events.data(), &Event::px, events.size())
+    template <typename Record>
+    bool Bind(Context &ctx, size_t slot, const Record *records, const Scalar Record::*field, size_t n) const
+    {
+        const char *first = reinterpret_cast<const char*>(&(records->*field));
+        return Bind(ctx, slot, records, sizeof(Record), first - reinterpret_cast<const char*>(records), n);
+    }
+
+// the same for anything with data() and size(): std::vector, Eigen::Map, Eigen::ArrayXd etc.
+    template <typename Buffer>
+    bool Bind(Context &ctx, size_t slot, const Buffer &buf) const {return Bind(ctx, slot, buf.data(), buf.size());}
+
+    void Unbind(Context &ctx) const
+    {
+        ctx.Bound.clear();
+        ctx.BoundStride.clear();
+        ctx.BoundLen = 0;
+    }
+
+    bool Bind(size_t slot, const Scalar *data, size_t n) {return Bind(Ctx, slot, data, n);}
+    bool Bind(size_t slot, const void *base, size_t stride, size_t offset, size_t n) {return Bind(Ctx, slot, base, stride, offset, n);}
+    template <typename Record>
+    bool Bind(size_t slot, const Record *records, const Scalar Record::*field, size_t n) {return Bind(Ctx, slot, records, field, n);}
+    template <typename Buffer>
+    bool Bind(size_t slot, const Buffer &buf) {return Bind(Ctx, slot, buf);}
+    void Unbind() {Unbind(Ctx);}
+
+// evaluates the formula using the provided context
+// only the context is modified, so this can be called concurrently with separate contexts
+    VarType Eval(Context &ctx) const
+    {
+        if (Tiled(ctx)) {
+            VarType result;
+            RunTiled(ctx, result);
+            return result;
+        }
+        return Result(ctx);
+    }
+
+// EvalInto() writes the result into a caller-provided object instead of returning a new one.
+// For vector VarType, once the context has been used with vectors of the same length and result
+// has that length, the evaluation does not allocate memory.
+    void EvalInto(Context &ctx, VarType &result) const
+    {
+        if (Tiled(ctx))
+            RunTiled(ctx, result);
+        else
+            result = Result(ctx);
+    }
+
+    void EvalInto(Context &ctx, const VarType &x, VarType &result) const
+    {
+        SetX(ctx, x);
+        EvalInto(ctx, result);
+    }
+
+    void EvalInto(VarType &result) {EvalInto(Ctx, result);}
+    void EvalInto(const VarType &x, VarType &result) {EvalInto(Ctx, x, result);}
+
+// Evaluates the formula for every element of the buffers bound with Bind() and writes the results
+// to out, which holds as many elements. The variables which are not bound keep their values in the context.
+    void EvalInto(Context &ctx, Scalar *out) const
+    {
+        const size_t nvar = VarName.size();
+        if (ctx.Bound.size() < nvar) {
+            ctx.Bound.resize(nvar, nullptr);
+            ctx.BoundStride.resize(nvar);
+        }
+        if constexpr(std::is_scalar<VarType>::value) {
+            // contiguous aligned buffers are the columns themselves, strided ones are gathered batch by batch
+            ctx.Gathered.resize(nvar*BatchSize);
+            ctx.GatheredCol.resize(nvar);
+            const size_t n = ctx.BoundLen;
+            for (size_t start=0; start<n; start+=BatchSize) {
+                const size_t len = std::min(BatchSize, n-start);
+                for (size_t v=0; v<nvar; v++) {
+                    const char *p = ctx.Bound[v];
+                    if (!p)
+                        ctx.GatheredCol[v] = nullptr;
+                    else if (ctx.BoundStride[v] == sizeof(Scalar) && reinterpret_cast<uintptr_t>(p) % alignof(Scalar) == 0)
+                        ctx.GatheredCol[v] = reinterpret_cast<const Scalar*>(p) + start;
+                    else {
+                        VarType *dst = ctx.Gathered.data() + v*BatchSize;
+                        Gather(ctx, v, start, len, dst);
+                        ctx.GatheredCol[v] = dst;
+                    }
+                }
+                EvalBatch(ctx, ctx.GatheredCol.data(), len, out + start);
+            }
+        }
+        else {
+            const int veclen = ctx.veclen;
+            ctx.veclen = ctx.BoundLen;
+            RunTiled(ctx, VarType::Map(out, ctx.BoundLen));
+            ctx.veclen = veclen;
+        }
+    }
+
+    void EvalInto(Scalar *out) {EvalInto(Ctx, out);}
+
+// Sum over the points of the buffers bound with Bind() (see Reduction), computed in the same pass
+// as the evaluation: the values of the formula are never stored for all points at once, and the
+// memory of the context is reused from call to call. w, y and sigma hold an element for every point
+// and may be null (no weights, y = 0, sigma = 1). The terms are summed pairwise in blocks of BatchSize
+// points, and the block sums pairwise again, so the result does not depend on the number of threads.
+// For Eigen types all input variables must be bound.
+    Scalar Reduce(Context &ctx, Reduction r, const Scalar *w = nullptr, const Scalar *y = nullptr, const Scalar *sigma = nullptr) const
+    {
+        const size_t chunk = 16*BatchSize;
+        const size_t n = ctx.BoundLen;
+        if (ctx.Bound.size() < VarName.size()) {
+            ctx.Bound.resize(VarName.size(), nullptr);
+            ctx.BoundStride.resize(VarName.size());
+        }
+        ctx.BlockSum.resize((n + BatchSize - 1)/BatchSize);
+        for (size_t start=0; start<n; start+=chunk)
+            ReduceChunk(ctx, r, start, std::min(chunk, n - start), w, y, sigma, ctx.BlockSum.data() + start/BatchSize);
+        return PairwiseSum(ctx.BlockSum.data(), ctx.BlockSum.size());
+    }
+
+// the same on the threads of the pool, with the bindings and the other variables of ctx
+    Scalar Reduce(VThreadPool &pool, const Context &ctx, Reduction r, const Scalar *w = nullptr, const Scalar *y = nullptr, const Scalar *sigma = nullptr) const
+    {
+        const size_t chunk = 16*BatchSize;
+        const size_t n = ctx.BoundLen;
+        std::vector <Context> ctxs(pool.GetThreadCount(), ctx);
+        for (Context &c : ctxs)
+            if (c.Bound.size() < VarName.size()) {
+                c.Bound.resize(VarName.size(), nullptr);
+                c.BoundStride.resize(VarName.size());
+            }
+        std::vector <Scalar> blocksum((n + BatchSize - 1)/BatchSize);
+
+        pool.Run((n + chunk - 1)/chunk, [&](size_t task, unsigned worker) {
+            const size_t start = task*chunk;
+            ReduceChunk(ctxs[worker], r, start, std::min(chunk, n - start), w, y, sigma, blocksum.data() + start/BatchSize);
+        });
+        return PairwiseSum(blocksum.data(), blocksum.size());
+    }
+
+    Scalar Reduce(Reduction r, const Scalar *w = nullptr, const Scalar *y = nullptr, const Scalar *sigma = nullptr)
+    {
+        return Reduce(Ctx, r, w, y, sigma);
+    }
+
+// Native code for VarType double: Compile() translates the parsed program into x86-64 machine code,
+// EvalNative() runs it. Both fall back to the interpreter if the code can not be generated
+// (other platform or VarType): Compile() then returns false and EvalNative() calls Eval().
+// The code reads the constants at run time, SetConstant() does not require recompilation.
+    bool Compile()
+    {
+        Jit.Clear();
+        if constexpr(std::is_same<VarType, double>::value)
+            return Jit.Compile(*this, Oper, Func);
+        else
+            return false;
+    }
+
+    bool IsCompiled() const {return Jit.Get() != nullptr;}
+
+    VarType EvalNative(Context &ctx) const
+    {
+        if constexpr(std::is_same<VarType, double>::value) {
+            VJit::NativeFunc native = Jit.Get();
+            if (native) {
+                if (ctx.Var.size() < VarName.size())
+                    ctx.Var.resize(VarName.size());
+                if (ctx.Stack.size() < StackDepth)
+                    ctx.Stack.resize(StackDepth);
+                return native(ctx.Var.data(), Const.data(), ctx.Stack.data());
+            }
+        }
+        return Eval(ctx);
+    }
+
+    VarType EvalNative(Context &ctx, VarType x) const
+    {
+        if (ctx.Var.size() < VarName.size())
+            ctx.Var.resize(VarName.size());
+        ctx.Var[0] = x;
+        return EvalNative(ctx);
+    }
+
+    VarType EvalNative(VarType x) {return EvalNative(Ctx, x);}
+
+    void SetBackend(Backend mode) {Mode = mode;}
+    Backend GetBackend() const {return Mode;}
+
+// Formulas which do not need full precision can use the faster approximations of exp, log, sin, cos
+// and pow from VApprox, with the relative error below 1e-12 or 1e-6, instead of cmath. This applies to
+// every backend (a compiled formula is recompiled), as long as the elements of VarType are double;
+// for other types the accuracy stays Exact. With SetSimdMath() the batch evaluator uses the SIMD
+// kernels, which are more accurate, wherever they exist.
+    void SetAccuracy(Accuracy acc)
+    {
+        if constexpr(DoubleElements()) {
+            MkMath(acc);
+            Precision = acc;
+            UpdateHoisted();
+            MkSimd();
+            DecodeThreaded();
+            if (IsCompiled())
+                Compile();
+        }
+    }
+    Accuracy GetAccuracy() const {return Precision;}
+
+// Eigen vectors longer than the tile size are evaluated in tiles of that many elements (rounded
+// down to a multiple of 16), which keeps the intermediate results in cache. The result does not
+// depend on it; 0 disables tiling.
+    void SetTileSize(size_t size) {TileSize = size;}
+    size_t GetTileSize() const {return TileSize;}
+
+    VarType Eval(Context &ctx, const VarType &x) const
+    {
+        SetX(ctx, x);
+        return Eval(ctx);
+    }
+
+    VarType Eval(Context &ctx, const VarType &x, const VarType &y) const
+    {
+        if (ctx.Var.size() < VarName.size())
+            ctx.Var.resize(VarName.size());
+        ctx.Var[0] = x;
+        ctx.Var[1] = y;
         if constexpr(!std::is_scalar<VarType>::value)
-            veclen = x.size();
-        return Eval();
+            ctx.veclen = x.size();
+        return Eval(ctx);
+    }
+
+    VarType Eval() {return Eval(Ctx);}
+    VarType Eval(const VarType &x) {return Eval(Ctx, x);}
+    VarType Eval(const VarType &x, const VarType &y) {return Eval(Ctx, x, y);}
+
+// Value and gradient by reverse-mode differentiation, for floating point VarType. pargrad receives
+// the derivatives with respect to the named constants (GetConstCount() values, in the order of
+// GetConstMap()), vargrad those with respect to the variables (in the order of GetVarMap());
+// either can be null. The program runs once forward, keeping every intermediate value, then once
+// backward. The assigned variables of the context are not updated.
+    VarType EvalGrad(Context &ctx, VarType *pargrad, VarType *vargrad = nullptr) const
+    {
+        static_assert(std::is_floating_point<VarType>::value, "EvalGrad() requires a floating point VarType");
+        const size_t npar = ConstName.size();
+        const size_t nvar = VarName.size();
+        if (pargrad)
+            std::fill(pargrad, pargrad + npar, VarType(0));
+        if (vargrad)
+            std::fill(vargrad, vargrad + nvar, VarType(0));
+        if (ctx.Var.size() < nvar)
+            ctx.Var.resize(nvar);
+        const size_t n = GradCode.size();
+        if (n == 0)
+            return VarType(0);
+        ctx.GradVal.resize(n);
+        ctx.GradAdj.assign(n, VarType(0));
+        VarType *v = ctx.GradVal.data();
+        VarType *d = ctx.GradAdj.data();
+        const Scalar *cnst = ConstData();
+
+        for (size_t i=0; i<n; i++) {
+            const GradCmd &c = GradCode[i];
+            switch (c.cmd) {
+                case CmdReadConst: v[i] = cnst[c.addr]; break;
+                case CmdReadVar: v[i] = ctx.Var[c.addr]; break;
+                case CmdOper: Oper[c.addr](v[i], v[c.a], v[c.b]); break;
+                case CmdFunc: Func[c.addr](v[i], v[c.a], v[c.b]); break;
+            }
+        }
+
+        d[GradResult] = 1;
+        for (size_t i=n; i-- > 0; ) {
+            const GradCmd &c = GradCode[i];
+            const VarType g = d[i];
+            if (g == 0)
+                continue;
+            if (c.cmd == CmdReadConst) {
+                if (pargrad && c.addr < npar)
+                    pargrad[c.addr] += g;
+                continue;
+            }
+            if (c.cmd == CmdReadVar) {
+                if (vargrad)
+                    vargrad[c.addr] += g;
+                continue;
+            }
+            const VarType a = v[c.a], b = v[c.b], r = v[i];
+            VarType &da = d[c.a], &db = d[c.b];
+            switch (c.rule) {
+                case GradAdd: da += g; db += g; break;
+                case GradSub: da += g; db -= g; break;
+                case GradMul: da += g*b; db += g*a; break;
+                case GradDiv: da += g/b; db -= g*r/b; break;
+                case GradPow:
+                    da += g*b*pow(a, b-1);
+                    db += a > 0 ? g*r*log(a) : a == 0 ? VarType(0) : VarType(NAN);
+                    break;
+                case GradNeg: da -= g; break;
+                case GradNop: da += g; break;
+                case GradPow2: da += 2*g*a; break;
+                case GradPow3: da += 3*g*a*a; break;
+                case GradAbs: da += a > 0 ? g : a < 0 ? -g : VarType(0); break;
+                case GradSqrt: da += g/(2*r); break;
+                case GradExp: da += g*r; break;
+                case GradLog: da += g/a; break;
+                case GradSin: da += g*cos(a); break;
+                case GradCos: da -= g*sin(a); break;
+                case GradTan: da += g*(1 + r*r); break;
+                case GradAsin: da += g/sqrt(1 - a*a); break;
+                case GradAcos: da -= g/sqrt(1 - a*a); break;
+                case GradAtan: da += g/(1 + a*a); break;
+                case GradSinh: da += g*cosh(a); break;
+                case GradCosh: da += g*sinh(a); break;
+                case GradTanh: da += g*(1 - r*r); break;
+                case GradAsinh: da += g/sqrt(a*a + 1); break;
+                case GradAcosh: da += g/sqrt(a*a - 1); break;
+                case GradAtanh: da += g/(1 - a*a); break;
+                // the kernels return b unless a is strictly greater (smaller)
+                case GradMax: (a > b ? da : db) += g; break;
+                case GradMin: (a < b ? da : db) += g; break;
+                default: { // a kernel added by the user: central differences
+                    FuncPtr fn = c.cmd == CmdOper ? Oper[c.addr] : Func[c.addr];
+                    int nargs = c.cmd == CmdOper ? OperArgs[c.addr] : FuncArgs[c.addr];
+                    VarType h = std::cbrt(std::numeric_limits<VarType>::epsilon()) * std::max(VarType(1), std::fabs(a));
+                    VarType up, down;
+                    fn(up, a + h, nargs == 2 ? b : a + h);
+                    fn(down, a - h, nargs == 2 ? b : a - h);
+                    da += g*(up - down)/(2*h);
+                    if (nargs == 2) {
+                        h = std::cbrt(std::numeric_limits<VarType>::epsilon()) * std::max(VarType(1), std::fabs(b));
+                        fn(up, a, b + h);
+                        fn(down, a, b - h);
+                        db += g*(up - down)/(2*h);
+                    }
+                }
+            }
+        }
+        return v[GradResult];
     }
 
+    VarType EvalGrad(Context &ctx, const VarType &x, VarType *pargrad, VarType *vargrad = nullptr) const
+    {
+        SetX(ctx, x);
+        return EvalGrad(ctx, pargrad, vargrad);
+    }
+
+    VarType EvalGrad(VarType *pargrad, VarType *vargrad = nullptr) {return EvalGrad(Ctx, pargrad, vargrad);}
+    VarType EvalGrad(const VarType &x, VarType *pargrad, VarType *vargrad = nullptr) {return EvalGrad(Ctx, x, pargrad, vargrad);}
+
+// Batch evaluation for scalar VarType: cols holds a pointer to the input column of n values for
+// every variable in VarName, out receives n results. The program is run once per BatchSize points,
+// each command operating on whole columns. A null column means that the variable keeps the value
+// set in the context (e.g. by SetVariable()); the columns of the variables assigned within the
+// program can be null. The assigned variables of the context are not updated.
+    void EvalBatch(Context &ctx, const VarType * const *cols, size_t n, VarType *out) const
+    {
+        static_assert(std::is_scalar<VarType>::value, "EvalBatch() requires a scalar VarType");
+        const size_t nvar = VarName.size();
+        if (ctx.Var.size() < nvar)
+            ctx.Var.resize(nvar);
+        if (ctx.BatchStack.size() < StackDepth*BatchSize)
+            ctx.BatchStack.resize(StackDepth*BatchSize);
+        if (ctx.BatchVar.size() < nvar*BatchSize)
+            ctx.BatchVar.resize(nvar*BatchSize);
+        ctx.BatchCol.resize(nvar);
+        const VarType **col = ctx.BatchCol.data();
+    // column of variable addr: a variable without input column is broadcast to its BatchVar column
+        auto column = [&ctx, col](size_t addr) {
+            if (!col[addr]) {
+                VarType *dst = ctx.BatchVar.data() + addr*BatchSize;
+                std::fill(dst, dst+BatchSize, ctx.Var[addr]);
+                col[addr] = dst;
+            }
+            return col[addr];
+        };
+
+        const BatchPtr *oper = SimdMath ? SimdOper.data() : BatchOper.data();
+        const BatchPtr *func = SimdMath ? SimdFunc.data() : BatchFunc.data();
+        const Scalar *cnst = ConstData();
+        const size_t codelen = Command.size();
+        for (size_t start=0; start<n; start+=BatchSize) {
+            const size_t len = std::min(BatchSize, n-start);
+            for (size_t v=0; v<nvar; v++)
+                col[v] = cols[v] ? cols[v] + start : nullptr;
+
+            VarType *sp = ctx.BatchStack.data(); // points to the first free column
+            VarType *res = out + start;
+            bool done = false;
+            for (size_t i=0; i<codelen && !done; i++) {
+                unsigned short cmd = Command[i].cmd;
+                unsigned short addr = Command[i].addr;
+                switch (cmd) {
+                    case CmdOper: {
+                        int nargs = OperArgs[addr];
+                        sp -= (nargs - 1)*BatchSize;
+                        oper[addr](sp-BatchSize, sp-BatchSize, sp+(nargs-2)*BatchSize, len);
+                        break;
+                    }
+                    case CmdFunc: {
+                        int nargs = FuncArgs[addr];
+                        sp -= (nargs - 1)*BatchSize;
+                        func[addr](sp-BatchSize, sp-BatchSize, sp+(nargs-2)*BatchSize, len);
+                        break;
+                    }
+                    case CmdReadConst:
+                        std::fill(sp, sp+len, cnst[addr]);
+                        sp += BatchSize;
+                        break;
+                    case CmdReadVar:
+                        std::copy(column(addr), column(addr)+len, sp);
+                        sp += BatchSize;
+                        break;
+                    case CmdWriteVar: {
+                        sp -= BatchSize;
+                        VarType *dst = ctx.BatchVar.data() + addr*BatchSize;
+                        std::copy(sp, sp+len, dst);
+                        col[addr] = dst;
+                        break;
+                    }
+                    case CmdReturn:
+                        sp -= BatchSize;
+                        std::copy(sp, sp+len, res);
+                        done = true;
+                        break;
+                    case CmdAddConst: case CmdSubConst: case CmdMulConst: case CmdDivConst:
+                    case CmdAddVar: case CmdSubVar: case CmdMulVar: case CmdDivVar: {
+                        VarType *r = sp - BatchSize;
+                        if (cmd >= CmdAddVar) {
+                            const VarType *b = column(addr);
+                            switch (cmd) {
+                                case CmdAddVar: ForColumn(r, len, [r, b](size_t k) {return r[k] + b[k];}); break;
+                                case CmdSubVar: ForColumn(r, len, [r, b](size_t k) {return r[k] - b[k];}); break;
+                                case CmdMulVar: ForColumn(r, len, [r, b](size_t k) {return r[k] * b[k];}); break;
+                                default:        ForColumn(r, len, [r, b](size_t k) {return r[k] / b[k];}); break;
+                            }
+                        } else {
+                            const VarType b = cnst[addr];
+                            switch (cmd) {
+                                case CmdAddConst: ForColumn(r, len, [r, b](size_t k) {return r[k] + b;}); break;
+                                case CmdSubConst: ForColumn(r, len, [r, b](size_t k) {return r[k] - b;}); break;
+                                case CmdMulConst: ForColumn(r, len, [r, b](size_t k) {return r[k] * b;}); break;
+                                default:          ForColumn(r, len, [r, b](size_t k) {return r[k] / b;}); break;
+                            }
+                        }
+                        break;
+                    }
+                    case CmdRSubConst:
+                    case CmdRDivConst: {
+                        VarType *r = sp - BatchSize;
+                        const VarType b = cnst[addr];
+                        if (cmd == CmdRSubConst)
+                            ForColumn(r, len, [r, b](size_t k) {return b - r[k];});
+                        else
+                            ForColumn(r, len, [r, b](size_t k) {return b / r[k];});
+                        break;
+                    }
+                    case CmdMulAddConst: {
+                        sp -= BatchSize;
+                        VarType *r = sp - BatchSize;
+                        const VarType c = cnst[addr];
+                        const VarType *a = sp;
+                        ForColumn(r, len, [r, a, c](size_t k) {return r[k] * a[k] + c;});
+                        break;
+                    }
+                    case CmdMulAddVar: {
+                        sp -= BatchSize;
+                        VarType *r = sp - BatchSize;
+                        const VarType *c = column(addr);
+                        const VarType *a = sp;
+                        ForColumn(r, len, [r, a, c](size_t k) {return r[k] * a[k] + c[k];});
+                        break;
+                    }
+                    default: // unknown command means a bug in the parser
+                        throw std::runtime_error(std::string("EvalBatch: Unknown command ") + std::to_string(cmd));
+                }
+            }
+            if (!done) // empty program - return 0
+                std::fill(res, res+len, VarType(0));
+        }
+    }
+
+    void EvalBatch(const VarType * const *cols, size_t n, VarType *out) {EvalBatch(Ctx, cols, n, out);}
+
+// Mixed precision: columns of another scalar type, e.g. float, while the formula computes in VarType,
+// e.g. double. The points are converted to VarType BatchSize at a time, and the results back.
+    template <typename IOType>
+    void EvalBatch(Context &ctx, const IOType * const *cols, size_t n, IOType *out) const
+    {
+        static_assert(std::is_scalar<VarType>::value && std::is_arithmetic<IOType>::value,
+                      "EvalBatch() with conversion requires scalar types");
+        const size_t nvar = VarName.size();
+        ctx.MixedIn.resize(nvar*BatchSize);
+        ctx.MixedOut.resize(BatchSize);
+        ctx.MixedCol.resize(nvar);
+        for (size_t start=0; start<n; start+=BatchSize) {
+            const size_t len = std::min(BatchSize, n-start);
+            for (size_t v=0; v<nvar; v++) {
+                ctx.MixedCol[v] = nullptr;
+                if (cols[v]) {
+                    VarType *dst = ctx.MixedIn.data() + v*BatchSize;
+                    for (size_t k=0; k<len; k++)
+                        dst[k] = cols[v][start+k];
+                    ctx.MixedCol[v] = dst;
+                }
+            }
+            EvalBatch(ctx, ctx.MixedCol.data(), len, ctx.MixedOut.data());
+            for (size_t k=0; k<len; k++)
+                out[start+k] = IOType(ctx.MixedOut[k]);
+        }
+    }
+
+    template <typename IOType>
+    void EvalBatch(const IOType * const *cols, size_t n, IOType *out) {EvalBatch(Ctx, cols, n, out);}
+
+// For VarType double, EvalBatch() (and EvalParallel() for columns) can use the SIMD kernels of VSimd,
+// which process 2, 4 or 8 points per instruction depending on the processor. The arithmetic gives
+// the same results; exp, log, sin, cos, tanh and pow differ from cmath by up to 2.5 ULP (see vsimd.h).
+// Off by default; has no effect for other types or where VSimd is not available.
+    void SetSimdMath(bool on) {SimdMath = on;}
+    bool GetSimdMath() const {return SimdMath;}
+
+// Parallel evaluation on the threads of a pool: the points are split into chunks, handed out to
+// the threads as they become free, and the results are written straight into the caller's buffer.
+// Every thread has its own context, the formula is shared as in the multithreaded use of Eval().
+// The results are identical to those of the single-threaded evaluation.
+
+// scalar VarType: the columns as for EvalBatch(), the variables without a column taken from ctx
+    void EvalParallel(VThreadPool &pool, const Context &ctx, const VarType * const *cols, size_t n, VarType *out) const
+    {
+        static_assert(std::is_scalar<VarType>::value, "EvalParallel() with columns requires a scalar VarType");
+        const size_t chunk = 16*BatchSize;
+        const size_t nvar = VarName.size();
+        std::vector <Context> ctxs(pool.GetThreadCount(), ctx);
+        std::vector <std::vector <const VarType*>> chunkcols(pool.GetThreadCount(), std::vector <const VarType*>(nvar));
+
+        pool.Run((n + chunk - 1)/chunk, [&](size_t task, unsigned worker) {
+            const size_t start = task*chunk;
+            std::vector <const VarType*> &c = chunkcols[worker];
+            for (size_t v=0; v<nvar; v++)
+                c[v] = cols[v] ? cols[v] + start : nullptr;
+            EvalBatch(ctxs[worker], c.data(), std::min(chunk, n - start), out + start);
+        });
+    }
+
+// Eigen vector VarType: x is the first variable, the other ones are taken from ctx. The chunks
+// are as long as the tiles (see SetTileSize()) and the result is resized to the length of x.
+    void EvalParallel(VThreadPool &pool, const Context &ctx, const VarType &x, VarType &result) const
+    {
+        static_assert(!std::is_scalar<VarType>::value, "EvalParallel() with a vector requires a vector VarType");
+        const size_t nvar = VarName.size();
+        const int n = x.size();
+        const unsigned nthreads = pool.GetThreadCount();
+        // a multiple of 16 elements, as the tiles, so that every element is computed as in Eval()
+        size_t chunk = TileSize ? TileSize : n/(4*nthreads);
+        chunk = std::max<size_t>(16, chunk/16*16);
+        std::vector <Context> ctxs;
+        for (unsigned i=0; i<nthreads; i++)
+            ctxs.push_back(MakeContext());
+        result.resize(n);
+
+        pool.Run((n + chunk - 1)/chunk, [&](size_t task, unsigned worker) {
+            const int start = task*chunk;
+            const int len = std::min<int>(chunk, n - start);
+            Context &c = ctxs[worker];
+            c.Var[0] = x.segment(start, len);
+            for (size_t v=1; v<nvar && v<ctx.Var.size(); v++)
+                if (ctx.Var[v].size() == n)
+                    c.Var[v] = ctx.Var[v].segment(start, len);
+            c.veclen = len;
+            result.segment(start, len) = Result(c);
+        });
+    }
+
+    void EvalParallel(VThreadPool &pool, const VarType * const *cols, size_t n, VarType *out) const
+    {
+        EvalParallel(pool, Ctx, cols, n, out);
+    }
+
+    void EvalParallel(VThreadPool &pool, const VarType &x, VarType &result) const
+    {
+        EvalParallel(pool, Ctx, x, result);
+    }
+
+};
+
+// Several formulas over the same variables, compiled into one program with one output per formula.
+// Subexpressions common to the formulas are computed once, and for the Eigen types every variable
+// is read once per evaluation of the set instead of once per formula. The constants and variables
+// are set up as for VFormula. The variables assigned in an expression are visible in the following
+// ones, as if the expressions were the semicolon-separated subexpressions of one formula.
+template <typename VarType>
+class VFormulaSet : public VFormula <VarType>
+{
+public:
+    typedef typename VFormula <VarType>::Context Context;
+
+// Returns 1024 on success, otherwise the error position in the expression GetFailedExpr().
+// Validate() checks the combined program.
+    int ParseExprs(const std::vector <std::string> &exprs)
+    {
+        int errpos = VParser::ParseExprs(exprs, OutVar, Failed);
+        Count = errpos == 1024 ? exprs.size() : 0;
+        if (errpos == 1024)
+            this->Optimize();
+        this->Prepare();
+        return errpos;
+    }
+
+// A set parsed or loaded as one formula has one output, the value of its program. These replace
+// the ones of VFormula, which would keep the outputs of the expressions parsed before.
+    int ParseExpr(const std::string &expr) {return ParseExprs({expr});}
+
+    int ParseExpr(VProgramCache &cache, const std::string &expr)
+    {
+        int errpos = VFormula <VarType>::ParseExpr(cache, expr);
+        SetSingle(errpos == 1024);
+        return errpos;
+    }
+
+    void LoadProgram(const VProgram &prg)
+    {
+        VFormula <VarType>::LoadProgram(prg);
+        SetSingle(true);
+    }
+
+    size_t GetFailedExpr() const {return Failed;}
+    size_t size() const {return Count;} // number of outputs
+
+// evaluates all formulas, out receives size() results in the order of the expressions;
+// only the context is modified, so this can be called concurrently with separate contexts
+    void EvalAll(Context &ctx, VarType *out) const
+    {
+        if (Count == 0)
+            return;
+        if (this->Tiled(ctx)) {
+            this->RunTiled(ctx, out[Count-1], OutVar.data(), out, OutVar.size());
+            return;
+        }
+        out[Count-1] = this->Result(ctx);
+        for (size_t k=0; k<OutVar.size(); k++)
+            out[k] = ctx.Var[OutVar[k]];
+    }
+
+    void EvalAll(Context &ctx, const VarType &x, VarType *out) const
+    {
+        this->SetX(ctx, x);
+        EvalAll(ctx, out);
+    }
+
+    void EvalAll(VarType *out) {EvalAll(this->Ctx, out);}
+    void EvalAll(const VarType &x, VarType *out) {EvalAll(this->Ctx, x, out);}
+
+private:
+    std::vector <size_t> OutVar; // variables holding the results of all formulas but the last one
+    size_t Count = 0;
+    size_t Failed = 0;
+
+    void SetSingle(bool parsed)
+    {
+        OutVar.clear();
+        Failed = 0;
+        Count = parsed ? 1 : 0;
+    }
 };
 
 #endif // VFORMULA_H
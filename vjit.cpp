@@ -0,0 +1,223 @@
+#include "vjit.h"
+#include "vformula.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define VJIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool VJit::Available()
+{
+#ifdef VJIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef VJIT_X86_64
+
+namespace {
+
+// register numbers
+enum {RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+const int VAR = RBX;   // base of the variables
+const int CNST = R14;  // base of the constants
+const int STK = R15;   // base of the evaluator stack
+
+// minimal x86-64 assembler: only the instructions needed by the compiler below
+// memory operands are always [base + disp32], the bases used never require a SIB byte
+class Asm
+{
+public:
+    std::vector <uint8_t> code;
+
+    void byte(uint8_t b) {code.push_back(b);}
+    void dword(int32_t d) {for (int i=0; i<4; i++) byte((d >> (8*i)) & 0xFF);}
+    void qword(uint64_t q) {for (int i=0; i<8; i++) byte((q >> (8*i)) & 0xFF);}
+
+    void modrm_mem(int reg, int base, int32_t disp) {byte(0x80 | ((reg & 7) << 3) | (base & 7)); dword(disp);}
+    void rex(bool w, int reg, int base) 
+    {
+        uint8_t r = 0x40 | (w ? 8 : 0) | (reg >= 8 ? 4 : 0) | (base >= 8 ? 1 : 0);
+        if (r != 0x40)
+            byte(r);
+    }
+
+// F2 0F op: movsd (10 load, 11 store), addsd 58, mulsd 59, subsd 5C, minsd 5D, divsd 5E, maxsd 5F, sqrtsd 51
+    void sse_mem(uint8_t op, int xmm, int base, int32_t disp) {byte(0xF2); rex(false, xmm, base); byte(0x0F); byte(op); modrm_mem(xmm, base, disp);}
+    void sse_reg(uint8_t op, int dst, int src) {byte(0xF2); byte(0x0F); byte(op); byte(0xC0 | (dst << 3) | src);}
+    void movapd(int dst, int src) {byte(0x66); byte(0x0F); byte(0x28); byte(0xC0 | (dst << 3) | src);}
+
+    void push(int r) {rex(false, 0, r); byte(0x50 | (r & 7));}
+    void pop(int r) {rex(false, 0, r); byte(0x58 | (r & 7));}
+    void mov_rr(int dst, int src) {rex(true, src, dst); byte(0x89); byte(0xC0 | ((src & 7) << 3) | (dst & 7));}
+    void mov_load(int dst, int base, int32_t disp) {rex(true, dst, base); byte(0x8B); modrm_mem(dst, base, disp);}
+    void mov_store(int base, int32_t disp, int src) {rex(true, src, base); byte(0x89); modrm_mem(src, base, disp);}
+    void lea(int dst, int base, int32_t disp) {rex(true, dst, base); byte(0x8D); modrm_mem(dst, base, disp);}
+    void mov_imm64(int dst, uint64_t imm) {rex(true, 0, dst); byte(0xB8 | (dst & 7)); qword(imm);}
+    void call(int r) {rex(false, 0, r); byte(0xFF); byte(0xD0 | (r & 7));}
+    void btc63(int r) {rex(true, 0, r); byte(0x0F); byte(0xBA); byte(0xF8 | (r & 7)); byte(63);} // flip sign bit
+    void btr63(int r) {rex(true, 0, r); byte(0x0F); byte(0xBA); byte(0xF0 | (r & 7)); byte(63);} // clear sign bit
+    void ret() {byte(0xC3);}
+};
+
+const uint8_t MOVSD_LOAD = 0x10, MOVSD_STORE = 0x11, ADDSD = 0x58, MULSD = 0x59, SUBSD = 0x5C,
+              MINSD = 0x5D, DIVSD = 0x5E, MAXSD = 0x5F, SQRTSD = 0x51;
+
+} // namespace
+
+// generated function:
+//   push rbx, r14, r15 (this also aligns the stack for the kernel calls)
+//   rbx = var, r14 = cnst, r15 = stack
+//   ... one block per command, stack element k is at [r15 + 8*k] ...
+//   xmm0 = result, pop r15, r14, rbx, ret
+bool VJit::Compile(const VParser &prg, const std::vector <Kernel> &oper, const std::vector <Kernel> &func)
+{
+    Clear();
+    const std::vector <VParser::Cmdaddr> &cmds = prg.Command;
+    if (cmds.empty() || cmds.back().cmd != VParser::CmdReturn)
+        return false;
+
+    Asm a;
+    a.push(RBX); a.push(R14); a.push(R15);
+    a.mov_rr(VAR, RDI); a.mov_rr(CNST, RSI); a.mov_rr(STK, RDX);
+
+    int k = 0; // current stack depth
+    auto slot = [](int n) {return 8*n;};
+    auto call = [&a, &slot](Kernel kernel, int r, int b) {
+        a.lea(RDI, STK, slot(r)); a.lea(RSI, STK, slot(r)); a.lea(RDX, STK, slot(b));
+        a.mov_imm64(RAX, reinterpret_cast<uint64_t>(kernel));
+        a.call(RAX);
+    };
+
+    for (const VParser::Cmdaddr &c : cmds) {
+        int addr = c.addr;
+        switch (c.cmd) {
+            case VParser::CmdReadConst:
+            case VParser::CmdReadVar:
+                a.sse_mem(MOVSD_LOAD, 0, c.cmd == VParser::CmdReadConst ? CNST : VAR, slot(addr));
+                a.sse_mem(MOVSD_STORE, 0, STK, slot(k++));
+                break;
+            case VParser::CmdWriteVar:
+                a.sse_mem(MOVSD_LOAD, 0, STK, slot(--k));
+                a.sse_mem(MOVSD_STORE, 0, VAR, slot(addr));
+                break;
+            case VParser::CmdReturn:
+                if (k != 1)
+                    return false;
+                a.sse_mem(MOVSD_LOAD, 0, STK, slot(0));
+                a.pop(R15); a.pop(R14); a.pop(RBX);
+                a.ret();
+                k = 0;
+                break;
+            case VParser::CmdAddConst: case VParser::CmdSubConst: case VParser::CmdMulConst: case VParser::CmdDivConst:
+            case VParser::CmdAddVar: case VParser::CmdSubVar: case VParser::CmdMulVar: case VParser::CmdDivVar: {
+                const uint8_t ops[] = {ADDSD, SUBSD, MULSD, DIVSD};
+                bool isconst = c.cmd <= VParser::CmdDivConst;
+                int op = c.cmd - (isconst ? VParser::CmdAddConst : VParser::CmdAddVar);
+                a.sse_mem(MOVSD_LOAD, 0, STK, slot(k-1));
+                a.sse_mem(ops[op], 0, isconst ? CNST : VAR, slot(addr));
+                a.sse_mem(MOVSD_STORE, 0, STK, slot(k-1));
+                break;
+            }
+            case VParser::CmdRSubConst:
+            case VParser::CmdRDivConst:
+                a.sse_mem(MOVSD_LOAD, 0, CNST, slot(addr));
+                a.sse_mem(c.cmd == VParser::CmdRSubConst ? SUBSD : DIVSD, 0, STK, slot(k-1));
+                a.sse_mem(MOVSD_STORE, 0, STK, slot(k-1));
+                break;
+            case VParser::CmdMulAddConst:
+            case VParser::CmdMulAddVar:
+                k--;
+                a.sse_mem(MOVSD_LOAD, 0, STK, slot(k-1));
+                a.sse_mem(MULSD, 0, STK, slot(k));
+                a.sse_mem(ADDSD, 0, c.cmd == VParser::CmdMulAddConst ? CNST : VAR, slot(addr));
+                a.sse_mem(MOVSD_STORE, 0, STK, slot(k-1));
+                break;
+            case VParser::CmdOper:
+            case VParser::CmdFunc: {
+                bool isoper = c.cmd == VParser::CmdOper;
+                int nargs = isoper ? prg.OperArgs[addr] : prg.FuncArgs[addr];
+                const std::string &mnem = isoper ? prg.OperMnem[addr] : prg.FuncMnem[addr];
+                Kernel kernel = isoper ? oper[addr] : func[addr];
+                if (nargs == 2)
+                    k--;
+                if (k < 1)
+                    return false;
+                int r = k-1, b = nargs == 2 ? k : k-1; // result/first argument, second argument
+
+                if (nargs == 2 && (mnem == "ADD" || mnem == "SUB" || mnem == "MUL" || mnem == "DIV" ||
+                                   mnem == "MAX" || mnem == "MIN")) {
+                    // max(b,a) of the interpreter returns a if b < a, else b: this is exactly maxsd a,b
+                    uint8_t op = mnem == "ADD" ? ADDSD : mnem == "SUB" ? SUBSD : mnem == "MUL" ? MULSD :
+                                 mnem == "DIV" ? DIVSD : mnem == "MAX" ? MAXSD : MINSD;
+                    a.sse_mem(MOVSD_LOAD, 0, STK, slot(r));
+                    a.sse_mem(op, 0, STK, slot(b));
+                    a.sse_mem(MOVSD_STORE, 0, STK, slot(r));
+                } else if (nargs == 1 && (mnem == "NEG" || mnem == "ABS")) {
+                    a.mov_load(RAX, STK, slot(r));
+                    if (mnem == "NEG")
+                        a.btc63(RAX);
+                    else
+                        a.btr63(RAX);
+                    a.mov_store(STK, slot(r), RAX);
+                } else if (nargs == 1 && mnem == "NOP") {
+                    ;
+                } else if (nargs == 1 && (mnem == "POW2" || mnem == "POW3")) {
+                    a.sse_mem(MOVSD_LOAD, 0, STK, slot(r));
+                    a.movapd(1, 0);
+                    a.sse_reg(MULSD, 0, 1);
+                    if (mnem == "POW3")
+                        a.sse_reg(MULSD, 0, 1);
+                    a.sse_mem(MOVSD_STORE, 0, STK, slot(r));
+                } else if (nargs == 1 && mnem == "SQRT") {
+                    a.sse_mem(SQRTSD, 0, STK, slot(r));
+                    a.sse_mem(MOVSD_STORE, 0, STK, slot(r));
+                } else if (kernel) {
+                    call(kernel, r, b);
+                } else
+                    return false;
+                break;
+            }
+            case VParser::CmdNop:
+                break;
+            default:
+                return false;
+        }
+        if (k < 0 || (size_t)k > prg.StackDepth)
+            return false;
+        if (c.cmd == VParser::CmdReturn)
+            break;
+    }
+
+// copy the code into an executable buffer: it is never writable and executable at the same time
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t size = (a.code.size() + pagesize - 1) / pagesize * pagesize;
+    void *buf = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        return false;
+    memcpy(buf, a.code.data(), a.code.size());
+    if (mprotect(buf, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(buf, size);
+        return false;
+    }
+    Code = std::shared_ptr <void> (buf, [size](void *p) {munmap(p, size);});
+    Func = reinterpret_cast<NativeFunc>(buf);
+    return true;
+}
+
+#else // no code generation on this platform
+
+bool VJit::Compile(const VParser &, const std::vector <Kernel> &, const std::vector <Kernel> &)
+{
+    Clear();
+    return false;
+}
+
+#endif
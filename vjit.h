@@ -0,0 +1,33 @@
+#ifndef VJIT_H
+#define VJIT_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class VParser;
+
+// Translates a VParser program into x86-64 machine code for scalar double evaluation.
+// The generated function keeps the evaluator stack in memory at the offsets known at compile time,
+// arithmetic is done with SSE2 scalar instructions and all other operations and functions are
+// called through the same kernels the interpreter uses.
+class VJit
+{
+public:
+// generated code: var, cnst and stack point to the variables, the constants and the evaluator stack
+    typedef double (*NativeFunc)(double *var, const double *cnst, double *stack);
+// kernel of an operation or a function, as in VFormula<double>
+    typedef void (*Kernel)(double &r, const double &a, const double &b);
+
+    static bool Available(); // true if the code can be generated and run on this platform
+
+    bool Compile(const VParser &prg, const std::vector <Kernel> &oper, const std::vector <Kernel> &func);
+    void Clear() {Code.reset(); Func = nullptr;}
+    NativeFunc Get() const {return Func;}
+
+private:
+    std::shared_ptr <void> Code;  // executable buffer, shared by the copies of the formula
+    NativeFunc Func = nullptr;
+};
+
+#endif // VJIT_H
@@ -0,0 +1,76 @@
+#include "vpool.h"
+
+VThreadPool::VThreadPool(unsigned nthreads)
+{
+    if (nthreads == 0)
+        nthreads = std::thread::hardware_concurrency();
+    for (unsigned i=1; i<nthreads; i++)
+        Workers.emplace_back(&VThreadPool::Work, this, i);
+}
+
+VThreadPool::~VThreadPool()
+{
+    {
+        std::lock_guard <std::mutex> lock(Mutex);
+        Stop = true;
+    }
+    Wake.notify_all();
+    for (std::thread &w : Workers)
+        w.join();
+}
+
+void VThreadPool::Run(size_t ntasks, const Job &job)
+{
+    std::lock_guard <std::mutex> serial(RunMutex);
+    if (ntasks == 0)
+        return;
+    {
+        std::lock_guard <std::mutex> lock(Mutex);
+        Current = &job;
+        NTasks = ntasks;
+        Next = 0;
+        Error = nullptr;
+        Busy = Workers.size();
+        Generation++;
+    }
+    Wake.notify_all();
+    Drain(0);
+
+    std::unique_lock <std::mutex> lock(Mutex);
+    Done.wait(lock, [this]() {return Busy == 0;});
+    Current = nullptr;
+    if (Error)
+        std::rethrow_exception(Error);
+}
+
+void VThreadPool::Work(unsigned worker)
+{
+    unsigned long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock <std::mutex> lock(Mutex);
+            Wake.wait(lock, [this, seen]() {return Stop || Generation != seen;});
+            if (Stop)
+                return;
+            seen = Generation;
+        }
+        Drain(worker);
+        std::lock_guard <std::mutex> lock(Mutex);
+        if (--Busy == 0)
+            Done.notify_one();
+    }
+}
+
+void VThreadPool::Drain(unsigned worker)
+{
+    for (size_t task = Next++; task < NTasks; task = Next++) {
+        try {
+            (*Current)(task, worker);
+        } catch (...) {
+            std::lock_guard <std::mutex> lock(Mutex);
+            if (!Error)
+                Error = std::current_exception();
+            Next = NTasks;
+        }
+    }
+}
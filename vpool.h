@@ -0,0 +1,51 @@
+#ifndef VPOOL_H
+#define VPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running numbered tasks. The calling thread takes part in
+// the work as worker 0, so a pool of n threads starts n-1 of its own. The threads wait
+// between the jobs, so the pool is meant to be created once and reused.
+class VThreadPool
+{
+public:
+// a task: task number in [0, ntasks), worker number in [0, GetThreadCount())
+    typedef std::function<void(size_t task, unsigned worker)> Job;
+
+    explicit VThreadPool(unsigned nthreads = 0); // 0 - one thread per hardware core
+    ~VThreadPool();
+    VThreadPool(const VThreadPool &) = delete;
+    VThreadPool &operator=(const VThreadPool &) = delete;
+
+    unsigned GetThreadCount() const {return Workers.size() + 1;}
+
+// runs job for every task number and returns when all are done. The tasks are handed out
+// one by one to the threads as they become free. If a task throws, the remaining tasks are
+// skipped and the first exception is rethrown here. Calls from several threads are serialized.
+    void Run(size_t ntasks, const Job &job);
+
+private:
+    void Work(unsigned worker);  // body of a pool thread
+    void Drain(unsigned worker); // runs the tasks of the current job until none is left
+
+    std::vector <std::thread> Workers;
+    std::mutex RunMutex;         // one job at a time
+    std::mutex Mutex;            // protects the fields below
+    std::condition_variable Wake, Done;
+    const Job *Current = nullptr;
+    size_t NTasks = 0;
+    std::atomic <size_t> Next{0};  // next task to hand out
+    unsigned Busy = 0;             // pool threads still working on the current job
+    unsigned long Generation = 0;  // incremented for every job
+    bool Stop = false;
+    std::exception_ptr Error;
+};
+
+#endif // VPOOL_H
@@ -0,0 +1,475 @@
+#include "vsimd.h"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define VSIMD_X86
+#endif
+
+#ifdef VSIMD_X86
+
+namespace {
+
+// The kernels are written once with the GCC vector extensions for N doubles per vector and
+// inlined into the functions compiled for each instruction set. There are no fused multiply-adds,
+// so every instruction set gives the same results.
+#define VSIMD_INLINE inline __attribute__((always_inline))
+// the wide vectors are only passed between always inlined functions, never through the ABI
+#pragma GCC diagnostic ignored "-Wpsabi"
+// AVX-512 includes FMA: keep a*b+c rounded twice, as on the other instruction sets
+#pragma GCC optimize ("fp-contract=off")
+
+template <int N> struct Vec {
+    typedef double D __attribute__((vector_size(8*N)));
+    typedef int64_t I __attribute__((vector_size(8*N)));
+};
+
+template <class D> VSIMD_INLINE D Splat(double c) {return D{} + c;}
+
+template <class D, class I> VSIMD_INLINE D Abs(const D &x) {return (D)((I)x & 0x7fffffffffffffffLL);}
+
+// OR of the halves, quarters... of the mask kept in the registers
+template <int N, class I> VSIMD_INLINE bool Any(const I &mask)
+{
+    I m = mask;
+    for (int half = N/2; half > 0; half /= 2) {
+        I idx{};
+        for (int i=0; i<N; i++)
+            idx[i] = i ^ half;
+        m |= __builtin_shuffle(m, idx);
+    }
+    return m[0] != 0;
+}
+
+// x = k*ln2 + r, |r| <= ln2/2: exp(x) = 2^k * exp(r), exp(r) from its Taylor series.
+// Valid for |x| <= 708, where 2^k is a normal number.
+// Each function of one argument comes with the test for the arguments which have to be passed to cmath.
+const double Ln2Hi = 6.93147180369123816490e-01;  // ln2 with the 21 lowest bits clear: k*Ln2Hi is exact
+const double Ln2Lo = 1.90821492927058770002e-10;  // ln2 - Ln2Hi
+const double Shifter = 6755399441055744.;         // 1.5*2^52: x + Shifter rounds x to an integer
+
+template <int N> VSIMD_INLINE typename Vec<N>::D Exp(const typename Vec<N>::D &x)
+{
+    typedef typename Vec<N>::D D;
+    typedef typename Vec<N>::I I;
+    D t = x * 1.44269504088896338700e+00 + Shifter;
+    D k = t - Shifter;
+    I ki = (I)t - (I)Splat<D>(Shifter);
+    D r = (x - k*Ln2Hi) - k*Ln2Lo;
+    D p = Splat<D>(1./6227020800.);  // 1/13!
+    p = p*r + 1./479001600.;
+    p = p*r + 1./39916800.;
+    p = p*r + 1./3628800.;
+    p = p*r + 1./362880.;
+    p = p*r + 1./40320.;
+    p = p*r + 1./5040.;
+    p = p*r + 1./720.;
+    p = p*r + 1./120.;
+    p = p*r + 1./24.;
+    p = p*r + 1./6.;
+    p = p*r + 0.5;
+    p = p*r + 1.;
+    p = p*r + 1.;
+    return p * (D)((ki + 1023) << 52);
+}
+
+template <int N> VSIMD_INLINE typename Vec<N>::I ExpOut(const typename Vec<N>::D &x)
+{
+    return !(Abs<typename Vec<N>::D, typename Vec<N>::I>(x) <= 708.);  // also NaN
+}
+
+// x = 2^e * m, sqrt(2)/2 <= m < sqrt(2), f = m-1, s = f/(2+f):
+// log(m) = 2*atanh(s) = f - f^2/2 + s*(f^2/2 + R(s^2)) with the Taylor series R(z) = 2z/3 + 2z^2/5 + ...
+// (the arrangement of fdlibm). Valid for positive normal x.
+template <int N> VSIMD_INLINE typename Vec<N>::D Log(const typename Vec<N>::D &x)
+{
+    typedef typename Vec<N>::D D;
+    typedef typename Vec<N>::I I;
+    I bits = (I)x;
+    I e = (bits >> 52) - 1023;
+    D m = (D)((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+    I big = m > 1.41421356237309504880;
+    m = big ? m*0.5 : m;
+    e -= big;  // big is -1 where true
+    D f = m - 1.;
+    D s = f / (f + 2.);
+    D z = s*s;
+    D R = Splat<D>(2./23.);
+    R = R*z + 2./21.;
+    R = R*z + 2./19.;
+    R = R*z + 2./17.;
+    R = R*z + 2./15.;
+    R = R*z + 2./13.;
+    R = R*z + 2./11.;
+    R = R*z + 2./9.;
+    R = R*z + 2./7.;
+    R = R*z + 2./5.;
+    R = R*z + 2./3.;
+    R = R*z;
+    D hfsq = 0.5*f*f;
+    D dk = __builtin_convertvector(e, D);
+    return dk*Ln2Hi - ((hfsq - (s*(hfsq + R) + dk*Ln2Lo)) - f);
+}
+
+template <int N> VSIMD_INLINE typename Vec<N>::I LogOut(const typename Vec<N>::D &x)
+{
+    return !(x >= 2.2250738585072014e-308 && x <= 1.7976931348623157e308);
+}
+
+// x = k*pi/2 + r, |r| <= pi/4, with pi/2 split into three parts of 33 bits (fdlibm),
+// so the products with k are exact for |x| <= 1e5. sin(r) and cos(r) from their Taylor series.
+const double InvPio2 = 6.36619772367581382433e-01;
+const double Pio2_1 = 1.57079632673412561417e+00;
+const double Pio2_2 = 6.07710050630396597660e-11;
+const double Pio2_3 = 2.02226624871116645580e-21;
+
+template <int N> VSIMD_INLINE void SinCosCore(const typename Vec<N>::D &x, typename Vec<N>::D &sin,
+                                                    typename Vec<N>::D &cos, typename Vec<N>::I &quadrant)
+{
+    typedef typename Vec<N>::D D;
+    typedef typename Vec<N>::I I;
+    D t = x * InvPio2 + Shifter;
+    D k = t - Shifter;
+    quadrant = ((I)t - (I)Splat<D>(Shifter)) & 3;
+    D r = ((x - k*Pio2_1) - k*Pio2_2) - k*Pio2_3;
+    D z = r*r;
+    D s = Splat<D>(-1./121645100408832000.);  // -1/19!
+    s = s*z + 1./355687428096000.;
+    s = s*z - 1./1307674368000.;
+    s = s*z + 1./6227020800.;
+    s = s*z - 1./39916800.;
+    s = s*z + 1./362880.;
+    s = s*z - 1./5040.;
+    s = s*z + 1./120.;
+    s = s*z - 1./6.;
+    sin = r + r*z*s;
+    D c = Splat<D>(1./6402373705728000.);      // 1/18!
+    c = c*z - 1./20922789888000.;
+    c = c*z + 1./87178291200.;
+    c = c*z - 1./479001600.;
+    c = c*z + 1./3628800.;
+    c = c*z - 1./40320.;
+    c = c*z + 1./720.;
+    c = c*z - 1./24.;
+    c = c*z + 0.5;
+    cos = 1. - z*c;
+}
+
+template <int N> VSIMD_INLINE typename Vec<N>::I SinCosOut(const typename Vec<N>::D &x)
+{
+    return !(Abs<typename Vec<N>::D, typename Vec<N>::I>(x) <= 1e5);
+}
+
+template <int N> VSIMD_INLINE typename Vec<N>::D Sin(const typename Vec<N>::D &x)
+{
+    typedef typename Vec<N>::D D;
+    typedef typename Vec<N>::I I;
+    D s, c;
+    I q;
+    SinCosCore<N>(x, s, c, q);
+    D r = (q & 1) ? c : s;
+    r = (q & 2) ? -r : r;
+    return x == 0. ? x : r;  // keep the sign of zero
+}
+
+template <int N> VSIMD_INLINE typename Vec<N>::D Cos(const typename Vec<N>::D &x)
+{
+    typedef typename Vec<N>::D D;
+    typedef typename Vec<N>::I I;
+    D s, c;
+    I q;
+    SinCosCore<N>(x, s, c, q);
+    D r = (q & 1) ? s : c;
+    return ((q + 1) & 2) ? -r : r;
+}
+
+// |x| < 0.3: Taylor series x + c3*x^3 + ...; above: 1 - 2/(exp(2|x|)+1) with the sign of x,
+// |x| limited to 22, where tanh rounds to 1.
+template <int N> VSIMD_INLINE typename Vec<N>::D Tanh(const typename Vec<N>::D &x)
+{
+    typedef typename Vec<N>::D D;
+    typedef typename Vec<N>::I I;
+    D ax = Abs<D, I>(x);
+    D z = x*x;
+    D p = Splat<D>(1.59189050693289637e-05);
+    p = p*z - 3.92783238833168327e-05;
+    p = p*z + 9.69153795692945095e-05;
+    p = p*z - 2.39129114243552478e-04;
+    p = p*z + 5.90027440945585947e-04;
+    p = p*z - 1.45583438705131833e-03;
+    p = p*z + 3.59212803657248114e-03;
+    p = p*z - 8.86323552990219733e-03;
+    p = p*z + 2.18694885361552030e-02;
+    p = p*z - 5.39682539682539708e-02;
+    p = p*z + 1.33333333333333331e-01;
+    p = p*z - 3.33333333333333315e-01;
+    D small = x + x*z*p;
+    D e = Exp<N>(2.*(ax < 22. ? ax : Splat<D>(22.)));
+    D large = 1. - 2./(e + 1.);
+    large = (D)((I)large | ((I)x & (int64_t)0x8000000000000000ULL));
+    D r = ax < 0.3 ? small : large;
+    return x == 0. ? x : r;  // keep the sign of zero
+}
+
+template <int N> VSIMD_INLINE typename Vec<N>::I TanhOut(const typename Vec<N>::D &x)
+{
+    return x != x;
+}
+
+// exact product a*b = hi + lo without fused multiply-add (Dekker)
+template <class D> VSIMD_INLINE void TwoProd(const D &a, const D &b, D &hi, D &lo)
+{
+    D ca = a*134217729., cb = b*134217729.;
+    D ah = ca - (ca - a), bh = cb - (cb - b);
+    D al = a - ah, bl = b - bh;
+    hi = a*b;
+    lo = ((ah*bh - hi) + ah*bl + al*bh) + al*bl;
+}
+
+// exact sum a+b = hi + lo (Knuth)
+template <class D> VSIMD_INLINE void TwoSum(const D &a, const D &b, D &hi, D &lo)
+{
+    D s = a + b;
+    D bb = s - a;
+    lo = (a - (s - bb)) + (b - bb);
+    hi = s;
+}
+
+// pow(x, y) = exp(y*log(x)), with log(x) = hi + lo in extra precision and exp(hi + lo) = exp(hi)*(1 + lo).
+// Valid for positive normal x, |y| < 2^900 and |y*log(x)| <= 708.
+template <int N> VSIMD_INLINE typename Vec<N>::D Pow(const typename Vec<N>::D &x, const typename Vec<N>::D &y)
+{
+    typedef typename Vec<N>::D D;
+    typedef typename Vec<N>::I I;
+    I out = !(x >= 2.2250738585072014e-308 && x <= 1.7976931348623157e308 && Abs<D, I>(y) <= 8.4e270);
+    D xv = out ? Splat<D>(1.) : x;
+    D yv = out ? Splat<D>(0.) : y;
+
+    I bits = (I)xv;
+    I e = (bits >> 52) - 1023;
+    D m = (D)((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+    I big = m > 1.41421356237309504880;
+    m = big ? m*0.5 : m;
+    e -= big;
+    D f = m - 1.;
+    // s = f/(m+1) = shi + slo; m+1 = dhi + dlo exactly
+    D dhi = m + 1.;
+    D dlo = (1. - dhi) + m;
+    dlo = big ? dlo : (m - dhi) + 1.;
+    D shi = f / dhi;
+    D phi, plo;
+    TwoProd(shi, dhi, phi, plo);
+    D slo = (((f - phi) - plo) - shi*dlo) / dhi;
+    // log(m) = 2s + 2s^3/3 + s^5*R(s^2), R(z) = 2/5 + 2z/7 + ...; the first two terms are
+    // summed in extra precision, of slo only the parts in the first two terms are significant
+    D zh, zl, ch, cl, th, tl;
+    TwoProd(shi, shi, zh, zl);
+    TwoProd(shi, zh, ch, cl);
+    cl += shi*zl;  // s^3 = ch + cl
+    TwoProd(ch, Splat<D>(2./3.), th, tl);
+    tl += ch*3.7007434154171883e-17 + cl*(2./3.);  // 2/3 = 0.66666666666666663 + 3.7e-17
+    D z = zh;
+    D R = Splat<D>(2./23.);
+    R = R*z + 2./21.;
+    R = R*z + 2./19.;
+    R = R*z + 2./17.;
+    R = R*z + 2./15.;
+    R = R*z + 2./13.;
+    R = R*z + 2./11.;
+    R = R*z + 2./9.;
+    R = R*z + 2./7.;
+    R = R*z + 2./5.;
+    D dk = __builtin_convertvector(e, D);
+    D hi, lo, lo2;
+    TwoSum(dk*Ln2Hi, 2.*shi, hi, lo);
+    TwoSum(hi, th, hi, lo2);
+    lo += lo2 + tl + 2.*slo + 2.*z*slo + ch*z*R + dk*Ln2Lo;
+    D h = hi + lo;
+    lo = lo - (h - hi);
+    // y*log(x)
+    D zhi, zlo;
+    TwoProd(yv, h, zhi, zlo);
+    zlo += yv*lo;
+    I range = !(Abs<D, I>(zhi) <= 708.);
+    out |= range;
+    D ez = Exp<N>(zhi);
+    D r = ez + ez*zlo;
+    if (Any<N>(out))
+        for (int i=0; i<N; i++)
+            if (out[i])
+                r[i] = std::pow(x[i], y[i]);
+    return r;
+}
+
+// column drivers: whole vectors, then the remainder padded with ones
+template <int N> VSIMD_INLINE typename Vec<N>::D Load(const double *p, size_t n = N)
+{
+    typename Vec<N>::D v = Splat<typename Vec<N>::D>(1.);
+    std::memcpy(&v, p, n*sizeof(double));
+    return v;
+}
+
+template <int N> VSIMD_INLINE void Store(double *p, const typename Vec<N>::D &v, size_t n = N)
+{
+    std::memcpy(p, &v, n*sizeof(double));
+}
+
+// F(x) with the lanes selected by Out(x) recomputed with cmath if check is set
+template <int N, typename Vec<N>::D (*F)(const typename Vec<N>::D &),
+          typename Vec<N>::I (*Out)(const typename Vec<N>::D &), double (*Ref)(double)>
+VSIMD_INLINE typename Vec<N>::D Apply(const typename Vec<N>::D &x, bool check)
+{
+    typename Vec<N>::D r = F(x);
+    if (check) {
+        typename Vec<N>::I out = Out(x);
+        if (Any<N>(out))
+            for (int i=0; i<N; i++)
+                if (out[i])
+                    r[i] = Ref(x[i]);
+    }
+    return r;
+}
+
+// The arguments for cmath are rare: they are looked for in a quick pass over the column,
+// so that the main loop does not test every vector if there are none.
+template <int N, typename Vec<N>::D (*F)(const typename Vec<N>::D &),
+          typename Vec<N>::I (*Out)(const typename Vec<N>::D &), double (*Ref)(double)>
+VSIMD_INLINE void Map1(double *r, const double *a, size_t n)
+{
+    typename Vec<N>::I out{};
+    size_t i = 0;
+    for (; i+N <= n; i += N)
+        out |= Out(Load<N>(a+i));
+    if (i < n)
+        out |= Out(Load<N>(a+i, n-i));
+    const bool check = Any<N>(out);
+
+    for (i = 0; i+N <= n; i += N)
+        Store<N>(r+i, Apply<N, F, Out, Ref>(Load<N>(a+i), check));
+    if (i < n)
+        Store<N>(r+i, Apply<N, F, Out, Ref>(Load<N>(a+i, n-i), check), n-i);
+}
+
+template <int N, typename Vec<N>::D (*F)(const typename Vec<N>::D &, const typename Vec<N>::D &)>
+VSIMD_INLINE void Map2(double *r, const double *a, const double *b, size_t n)
+{
+    size_t i = 0;
+    for (; i+N <= n; i += N)
+        Store<N>(r+i, F(Load<N>(a+i), Load<N>(b+i)));
+    if (i < n)
+        Store<N>(r+i, F(Load<N>(a+i, n-i), Load<N>(b+i, n-i)), n-i);
+}
+
+template <int N> VSIMD_INLINE typename Vec<N>::D Add(const typename Vec<N>::D &a, const typename Vec<N>::D &b) {return a + b;}
+template <int N> VSIMD_INLINE typename Vec<N>::D Sub(const typename Vec<N>::D &a, const typename Vec<N>::D &b) {return a - b;}
+template <int N> VSIMD_INLINE typename Vec<N>::D Mul(const typename Vec<N>::D &a, const typename Vec<N>::D &b) {return a * b;}
+template <int N> VSIMD_INLINE typename Vec<N>::D Div(const typename Vec<N>::D &a, const typename Vec<N>::D &b) {return a / b;}
+
+// the kernels of one instruction set
+struct Kernels {
+    VSimd::Kernel exp, log, sin, cos, tanh, pow, add, sub, mul, div;
+};
+
+#define VSIMD_KERNELS(name, N, target) \
+    target void name##Exp(double *r, const double *a, const double *, size_t n) {Map1<N, Exp<N>, ExpOut<N>, std::exp>(r, a, n);} \
+    target void name##Log(double *r, const double *a, const double *, size_t n) {Map1<N, Log<N>, LogOut<N>, std::log>(r, a, n);} \
+    target void name##Sin(double *r, const double *a, const double *, size_t n) {Map1<N, Sin<N>, SinCosOut<N>, std::sin>(r, a, n);} \
+    target void name##Cos(double *r, const double *a, const double *, size_t n) {Map1<N, Cos<N>, SinCosOut<N>, std::cos>(r, a, n);} \
+    target void name##Tanh(double *r, const double *a, const double *, size_t n) {Map1<N, Tanh<N>, TanhOut<N>, std::tanh>(r, a, n);} \
+    target void name##Pow(double *r, const double *a, const double *b, size_t n) {Map2<N, Pow<N>>(r, a, b, n);} \
+    target void name##Add(double *r, const double *a, const double *b, size_t n) {Map2<N, Add<N>>(r, a, b, n);} \
+    target void name##Sub(double *r, const double *a, const double *b, size_t n) {Map2<N, Sub<N>>(r, a, b, n);} \
+    target void name##Mul(double *r, const double *a, const double *b, size_t n) {Map2<N, Mul<N>>(r, a, b, n);} \
+    target void name##Div(double *r, const double *a, const double *b, size_t n) {Map2<N, Div<N>>(r, a, b, n);} \
+    const Kernels name = {name##Exp, name##Log, name##Sin, name##Cos, name##Tanh, name##Pow, \
+                          name##Add, name##Sub, name##Mul, name##Div};
+
+VSIMD_KERNELS(Sse2, 2, __attribute__((target("sse2"))))
+VSIMD_KERNELS(Avx2, 4, __attribute__((target("avx2"))))
+VSIMD_KERNELS(Avx512, 8, __attribute__((target("avx512f"))))
+
+std::atomic <int> Selected{-1}; // level in use, -1 until detected
+
+const Kernels &Current()
+{
+    int level = Selected.load(std::memory_order_relaxed);
+    if (level < 0) {
+        level = VSimd::Detect();
+        Selected.store(level, std::memory_order_relaxed);
+    }
+    return level == VSimd::AVX512 ? Avx512 : level == VSimd::AVX2 ? Avx2 : Sse2;
+}
+
+// the kernels returned by Find(): dispatch to the instruction set in use
+void Exp(double *r, const double *a, const double *b, size_t n) {Current().exp(r, a, b, n);}
+void Log(double *r, const double *a, const double *b, size_t n) {Current().log(r, a, b, n);}
+void Sin(double *r, const double *a, const double *b, size_t n) {Current().sin(r, a, b, n);}
+void Cos(double *r, const double *a, const double *b, size_t n) {Current().cos(r, a, b, n);}
+void Tanh(double *r, const double *a, const double *b, size_t n) {Current().tanh(r, a, b, n);}
+void Pow(double *r, const double *a, const double *b, size_t n) {Current().pow(r, a, b, n);}
+void Add(double *r, const double *a, const double *b, size_t n) {Current().add(r, a, b, n);}
+void Sub(double *r, const double *a, const double *b, size_t n) {Current().sub(r, a, b, n);}
+void Mul(double *r, const double *a, const double *b, size_t n) {Current().mul(r, a, b, n);}
+void Div(double *r, const double *a, const double *b, size_t n) {Current().div(r, a, b, n);}
+
+} // namespace
+
+VSimd::Level VSimd::Detect()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SSE2;
+    return None;
+}
+
+VSimd::Level VSimd::GetLevel()
+{
+    Current();
+    return (Level)Selected.load(std::memory_order_relaxed);
+}
+
+void VSimd::SetLevel(Level level)
+{
+    if (level > Detect())
+        level = Detect();
+    Selected.store(level, std::memory_order_relaxed);
+}
+
+VSimd::Kernel VSimd::Find(const std::string &mnem)
+{
+    if (GetLevel() == None)
+        return nullptr;
+    static const struct {const char *mnem; Kernel kernel;} table[] = {
+        {"EXP", Exp}, {"LOG", Log}, {"SIN", Sin}, {"COS", Cos}, {"TANH", Tanh}, {"POW", Pow},
+        {"ADD", Add}, {"SUB", Sub}, {"MUL", Mul}, {"DIV", Div}
+    };
+    for (const auto &t : table)
+        if (mnem == t.mnem)
+            return t.kernel;
+    return nullptr;
+}
+
+#else // no SIMD kernels
+
+VSimd::Level VSimd::Detect() {return None;}
+VSimd::Level VSimd::GetLevel() {return None;}
+void VSimd::SetLevel(Level) {}
+VSimd::Kernel VSimd::Find(const std::string &) {return nullptr;}
+
+#endif
+
+const char *VSimd::LevelName(Level level)
+{
+    switch (level) {
+        case SSE2: return "SSE2";
+        case AVX2: return "AVX2";
+        case AVX512: return "AVX-512";
+        default: return "none";
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef VSIMD_H
+#define VSIMD_H
+
+#include <cstddef>
+#include <string>
+
+// Column kernels for double which evaluate several points per instruction with the widest
+// SIMD instruction set found at run time: SSE2 (2 doubles), AVX2 (4) or AVX-512 (8).
+// They have the signature of the column kernels of the batch evaluator and need no external
+// library. The arithmetic (ADD, SUB, MUL, DIV) gives the same results as the scalar code.
+// The functions are polynomial approximations, the same on every instruction set,
+// with the maximum error in units in the last place (ULP), measured over their whole range:
+//   EXP   < 1.2 ULP      LOG  < 1 ULP
+//   SIN   < 1.5 ULP      COS  < 1.5 ULP  (|x| <= 10; < 2.5 ULP for |x| <= 1e5)
+//   TANH  < 2.5 ULP      POW  < 2 ULP
+// These are the bounds of each kernel alone (checked by time_simd); in a formula the errors of
+// the kernels propagate through the other operations and add up, so there is no such bound for it.
+// Arguments outside of the polynomial domains (overflow, underflow, subnormals, infinities,
+// NaN, huge arguments of sin/cos, non-positive base of pow) are passed to cmath.
+// The kernels are available with GCC-compatible compilers on x86; elsewhere Find() returns nullptr.
+class VSimd
+{
+public:
+// r[i] = f(a[i], b[i]) for i < n; b is not used by the functions of one argument
+    typedef void (*Kernel)(double *r, const double *a, const double *b, size_t n);
+
+    enum Level {
+        None = 0,  // no kernels on this platform
+        SSE2,
+        AVX2,
+        AVX512
+    };
+
+    static Level Detect();              // the widest instruction set supported by the processor
+    static Level GetLevel();            // the instruction set in use, Detect() by default
+    static void SetLevel(Level level);  // selects a narrower instruction set, e.g. for testing
+    static const char *LevelName(Level level);
+
+// kernel for an operation or function mnemonic (as in VFormula), nullptr if there is none
+    static Kernel Find(const std::string &mnem);
+};
+
+#endif // VSIMD_H